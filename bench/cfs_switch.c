@@ -0,0 +1,543 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * USB mode switches of the cfs client, done the way deviced does them
+ * (disable, reconfigure_gadget, enable) on a fixed matrix of modes. The
+ * gadgets come from the usb_gadget module, the configfs, UDC and
+ * functionfs paths point to a tmpfs tree under BENCH_TREE.
+ *
+ * The tree is first made by going once through the matrix, then every
+ * transition is timed over BENCH_CYCLES cycles. The syscalls are counted
+ * on a second run, in a child traced like strace -c does it. The work
+ * done below to make tmpfs behave like configfs is not counted. The
+ * mount and umount2 calls, which are faked, count as one syscall each.
+ * The "module" column is the estimate of the module itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <gio/gio.h>
+#include <hw/usb_client.h>
+#include <hw/usb_gadget.h>
+#include <hw/shared.h>
+
+#ifndef BENCH_TREE
+#define BENCH_TREE "/dev/shm/device-manager-pico-bench"
+#endif
+
+#define CONFIGFS_GADGET_PATH  BENCH_TREE "/usb_gadget"
+#define UDC_PATH              BENCH_TREE "/udc"
+#define FFS_PATH              BENCH_TREE "/usb-funcs"
+#define USB_GADGET_POOL_CONF  BENCH_TREE "/usb-gadget-pool.conf"
+
+#define BENCH_UDC     "dummy_udc.0"
+#define BENCH_CYCLES  50
+
+/* A getppid() with this first argument is a marker for the tracer */
+#define BENCH_MARK  0x70696330
+
+enum bench_marker {
+	MARK_BEGIN,    /* transition, cycle */
+	MARK_END,
+	MARK_PAUSE,    /* work of the benchmark, not counted */
+	MARK_RESUME,
+	MARK_SYSCALL,  /* a faked syscall, counted */
+};
+
+static void bench_mark(enum bench_marker what, int a, int b)
+{
+	syscall(SYS_getppid, BENCH_MARK, what, a, b);
+}
+
+static int bench_write_file(const char *dir, const char *name, const char *val)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0) {
+		close(fd);
+		return -errno;
+	}
+	close(fd);
+	return 0;
+}
+
+static const char *const gadget_attrs[] = {
+	"idVendor", "idProduct", "bcdDevice",
+	"bDeviceClass", "bDeviceSubClass", "bDeviceProtocol",
+};
+
+/* the attributes and default groups configfs makes with a directory */
+static void bench_populate(const char *path)
+{
+	size_t root = strlen(CONFIGFS_GADGET_PATH);
+	char parent[PATH_MAX], sub[PATH_MAX], *p;
+	unsigned int i;
+
+	if (strncmp(path, CONFIGFS_GADGET_PATH "/", root + 1))
+		return;
+
+	snprintf(parent, sizeof(parent), "%s", path);
+	*strrchr(parent, '/') = '\0';
+	p = strrchr(parent, '/') + 1;
+
+	if (strlen(parent) == root) {
+		for (i = 0 ; i < ARRAY_SIZE(gadget_attrs) ; i++)
+			bench_write_file(path, gadget_attrs[i], "0x0000");
+		bench_write_file(path, "UDC", "\n");
+		snprintf(sub, sizeof(sub), "%s/functions", path);
+		mkdir(sub, 0755);
+		snprintf(sub, sizeof(sub), "%s/configs", path);
+		mkdir(sub, 0755);
+		snprintf(sub, sizeof(sub), "%s/strings", path);
+		mkdir(sub, 0755);
+	} else if (!strcmp(p, "configs")) {
+		bench_write_file(path, "MaxPower", "2");
+		bench_write_file(path, "bmAttributes", "0x80");
+		snprintf(sub, sizeof(sub), "%s/strings", path);
+		mkdir(sub, 0755);
+	} else if (!strcmp(p, "strings") && strstr(path + root, "/configs/")) {
+		bench_write_file(path, "configuration", "");
+	} else if (!strcmp(p, "strings")) {
+		bench_write_file(path, "manufacturer", "");
+		bench_write_file(path, "product", "");
+		bench_write_file(path, "serialnumber", "");
+	}
+}
+
+static int bench_mkdir(const char *path, mode_t mode)
+{
+	int ret = mkdir(path, mode);
+
+	if (ret == 0) {
+		bench_mark(MARK_PAUSE, 0, 0);
+		bench_populate(path);
+		bench_mark(MARK_RESUME, 0, 0);
+	}
+	return ret;
+}
+
+/* configfs drops the attributes and default groups with the directory */
+static int bench_rmdir(const char *path)
+{
+	struct dirent *dir;
+	DIR *d;
+
+	bench_mark(MARK_PAUSE, 0, 0);
+	d = opendir(path);
+	if (d) {
+		while ((dir = readdir(d))) {
+			if (!strcmp(dir->d_name, ".") || !strcmp(dir->d_name, ".."))
+				continue;
+			if (unlinkat(dirfd(d), dir->d_name, 0) < 0)
+				unlinkat(dirfd(d), dir->d_name, AT_REMOVEDIR);
+		}
+		closedir(d);
+	}
+	bench_mark(MARK_RESUME, 0, 0);
+
+	return rmdir(path);
+}
+
+/* configfs attributes always exist, tmpfs files are made on write */
+static int bench_open(const char *path, int flags)
+{
+	if (flags & (O_WRONLY | O_RDWR))
+		flags |= O_CREAT;
+	return open(path, flags, 0644);
+}
+
+static int bench_mount(const char *source, const char *target,
+		const char *type, unsigned long flags, const void *data)
+{
+	bench_mark(MARK_SYSCALL, 0, 0);
+	return 0;
+}
+
+static int bench_umount2(const char *target, int flags)
+{
+	bench_mark(MARK_SYSCALL, 0, 0);
+	return 0;
+}
+
+/* systemd jobs the module asked for, through the faked D-Bus calls */
+static unsigned int bench_jobs;
+
+static GVariant *bench_unit_job(const char *method, const char *unit)
+{
+	bench_jobs++;
+	return (GVariant *)&bench_jobs;
+}
+
+#define open(path, flags)  bench_open(path, flags)
+#define mkdir(path, mode)  bench_mkdir(path, mode)
+#define rmdir(path)        bench_rmdir(path)
+#define mount(s, t, type, f, d)  bench_mount(s, t, type, f, d)
+#define umount2(t, f)      bench_umount2(t, f)
+
+#define g_bus_get_sync(type, cancellable, err)  ((GDBusConnection *)&bench_jobs)
+#define g_object_unref(obj)                     ((void)(obj))
+#define g_variant_new(format, unit, mode)       ((GVariant *)(unit))
+#define g_variant_unref(v)                      ((void)(v))
+#define g_dbus_connection_call_sync(conn, dest, path, iface, method, params, \
+		type, flags, timeout, cancellable, err) \
+	bench_unit_job(method, (const char *)(params))
+
+#include "../hw/usb_cfs_client/usb_cfs_client.c"
+
+#undef open
+#undef mkdir
+#undef rmdir
+#undef mount
+#undef umount2
+
+extern struct hw_info bench_usb_gadget_hw_info;
+
+static const struct {
+	const char *name;
+	unsigned int functions;
+} bench_matrix[] = {
+	{ "none",      USB_FUNCTION_NONE },
+	{ "mtp",       USB_FUNCTION_MTP },
+	{ "mtp+sdb",   USB_FUNCTION_MTP | USB_FUNCTION_SDB },
+	{ "rndis",     USB_FUNCTION_RNDIS },
+	{ "rndis+sdb", USB_FUNCTION_RNDIS | USB_FUNCTION_SDB },
+	{ "acm+sdb",   USB_FUNCTION_ACM | USB_FUNCTION_SDB },
+	{ "mtp+sdb",   USB_FUNCTION_MTP | USB_FUNCTION_SDB },
+	{ "mtp",       USB_FUNCTION_MTP },
+	{ "none",      USB_FUNCTION_NONE },
+};
+
+#define BENCH_MODES        ARRAY_SIZE(bench_matrix)
+#define BENCH_TRANSITIONS  (BENCH_MODES - 1)
+
+struct bench_result {
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long bytes;
+	unsigned int jobs;
+	unsigned int estimate;
+	int syscalls_first;  /* while the tree is made, -1 if not traced */
+	int syscalls;        /* in the last cycle */
+};
+
+static struct bench_result results[BENCH_TRANSITIONS];
+static struct usb_gadget *gadgets[BENCH_MODES];
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_remove(const char *path)
+{
+	char sub[PATH_MAX];
+	struct dirent *dir;
+	DIR *d;
+
+	d = opendir(path);
+	if (!d) {
+		unlink(path);
+		return;
+	}
+	while ((dir = readdir(d))) {
+		if (!strcmp(dir->d_name, ".") || !strcmp(dir->d_name, ".."))
+			continue;
+		snprintf(sub, sizeof(sub), "%s/%s", path, dir->d_name);
+		if (dir->d_type == DT_DIR)
+			bench_remove(sub);
+		else
+			unlink(sub);
+	}
+	closedir(d);
+	rmdir(path);
+}
+
+static int bench_tree_reset(void)
+{
+	bench_remove(BENCH_TREE);
+
+	if (mkdir(BENCH_TREE, 0755) < 0 ||
+	    mkdir(CONFIGFS_GADGET_PATH, 0755) < 0 ||
+	    mkdir(UDC_PATH, 0755) < 0 ||
+	    mkdir(UDC_PATH "/" BENCH_UDC, 0755) < 0)
+		return -errno;
+	return 0;
+}
+
+static int bench_switch(struct usb_client *usb, int from, int to)
+{
+	int ret;
+
+	if (bench_matrix[from].functions) {
+		ret = usb->disable(usb);
+		if (ret < 0)
+			return ret;
+	}
+	if (!bench_matrix[to].functions)
+		return 0;
+
+	ret = usb->reconfigure_gadget(usb, gadgets[to]);
+	if (ret < 0)
+		return ret;
+	return usb->enable(usb);
+}
+
+/* the matrix, once to make the tree then BENCH_CYCLES times */
+static int bench_run(bool traced)
+{
+	struct hw_common *common;
+	struct usb_client *usb;
+	unsigned long long bytes;
+	unsigned int jobs, estimate;
+	uint64_t start, d;
+	int c, t, ret;
+
+	ret = cfs_client_open(&HARDWARE_INFO_SYM, NULL, &common);
+	if (ret < 0)
+		return ret;
+	usb = container_of(common, struct usb_client, common);
+
+	for (c = 0 ; c <= BENCH_CYCLES ; c++) {
+		for (t = 0 ; t < BENCH_TRANSITIONS ; t++) {
+			bytes = io.bytes;
+			estimate = io.syscalls;
+			jobs = bench_jobs;
+
+			if (traced)
+				bench_mark(MARK_BEGIN, t, c);
+			start = bench_now();
+			ret = bench_switch(usb, t, t + 1);
+			d = bench_now() - start;
+			if (traced)
+				bench_mark(MARK_END, t, c);
+			if (ret < 0)
+				goto out;
+
+			if (traced || c == 0)
+				continue;
+			results[t].total_ns += d;
+			if (d > results[t].max_ns)
+				results[t].max_ns = d;
+			results[t].bytes = io.bytes - bytes;
+			results[t].estimate = io.syscalls - estimate;
+			results[t].jobs = bench_jobs - jobs;
+		}
+	}
+
+out:
+	cfs_client_close(common);
+	return ret;
+}
+
+/* count the syscalls of a traced child between its markers */
+static int bench_trace(pid_t pid)
+{
+	struct __ptrace_syscall_info info;
+	int status, sig = 0, t = 0, c = 0, n = 0;
+	bool counting = false, paused = false;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+		return -ECHILD;
+	if (ptrace(PTRACE_SETOPTIONS, pid, 0,
+			PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL) < 0)
+		return -errno;
+
+	for (;;) {
+		if (ptrace(PTRACE_SYSCALL, pid, 0, sig) < 0)
+			return -errno;
+		if (waitpid(pid, &status, 0) < 0)
+			return -errno;
+		if (WIFEXITED(status))
+			return WEXITSTATUS(status) ? -EIO : 0;
+		if (WIFSIGNALED(status))
+			return -EINTR;
+
+		sig = 0;
+		if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+			sig = WSTOPSIG(status);
+			continue;
+		}
+
+		if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) <= 0)
+			return -errno;
+		if (info.op != PTRACE_SYSCALL_INFO_ENTRY)
+			continue;
+
+		if (info.entry.nr != SYS_getppid || info.entry.args[0] != BENCH_MARK) {
+			if (counting && !paused)
+				n++;
+			continue;
+		}
+
+		switch (info.entry.args[1]) {
+		case MARK_BEGIN:
+			t = info.entry.args[2];
+			c = info.entry.args[3];
+			n = 0;
+			counting = true;
+			break;
+		case MARK_END:
+			counting = false;
+			if (c == 0)
+				results[t].syscalls_first = n;
+			else if (c == BENCH_CYCLES)
+				results[t].syscalls = n;
+			break;
+		case MARK_PAUSE:
+			paused = true;
+			break;
+		case MARK_RESUME:
+			paused = false;
+			break;
+		case MARK_SYSCALL:
+			if (counting && !paused)
+				n++;
+			break;
+		}
+	}
+}
+
+static int bench_count_syscalls(void)
+{
+	pid_t pid;
+	int ret;
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+
+	if (pid == 0) {
+		if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0)
+			_exit(2);
+		raise(SIGSTOP);
+		_exit(bench_run(true) < 0 ? 1 : 0);
+	}
+
+	ret = bench_trace(pid);
+	if (ret < 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	return ret;
+}
+
+static void bench_syscalls(char *buf, size_t size, int n)
+{
+	if (n < 0)
+		snprintf(buf, size, "-");
+	else
+		snprintf(buf, size, "%d", n);
+}
+
+int main(void)
+{
+	struct usb_gadget_translator *translator;
+	struct usb_gadget_id id;
+	struct hw_common *common;
+	char first[16], steady[16];
+	int i, ret;
+
+	ret = bench_usb_gadget_hw_info.open(&bench_usb_gadget_hw_info, NULL, &common);
+	if (ret < 0) {
+		fprintf(stderr, "usb_gadget open failed (%d)\n", ret);
+		return 1;
+	}
+	translator = container_of(common, struct usb_gadget_translator, common);
+
+	for (i = 0 ; i < BENCH_MODES ; i++) {
+		if (!bench_matrix[i].functions)
+			continue;
+		memset(&id, 0, sizeof(id));
+		id.function_mask = bench_matrix[i].functions;
+		ret = translator->id_to_gadget(&id, &gadgets[i]);
+		if (ret < 0) {
+			fprintf(stderr, "No gadget for %s (%d)\n", bench_matrix[i].name, ret);
+			return 1;
+		}
+	}
+
+	for (i = 0 ; i < BENCH_TRANSITIONS ; i++) {
+		results[i].syscalls_first = -1;
+		results[i].syscalls = -1;
+	}
+
+	/* a fresh module and tree for each run */
+	ret = bench_tree_reset();
+	if (ret < 0) {
+		fprintf(stderr, "Failed to make %s (%d)\n", BENCH_TREE, ret);
+		return 1;
+	}
+	ret = bench_count_syscalls();
+	if (ret < 0)
+		fprintf(stderr, "Syscalls not counted (%d)\n", ret);
+
+	ret = bench_tree_reset();
+	if (ret == 0)
+		ret = bench_run(false);
+	if (ret < 0) {
+		fprintf(stderr, "Switch failed (%d)\n", ret);
+		return 1;
+	}
+
+	printf("%-24s %9s %9s %9s %9s %8s %7s %5s\n", "transition",
+			"avg us", "max us", "syscalls", "(first)", "module", "bytes", "jobs");
+	for (i = 0 ; i < BENCH_TRANSITIONS ; i++) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "%s -> %s",
+				bench_matrix[i].name, bench_matrix[i + 1].name);
+		bench_syscalls(steady, sizeof(steady), results[i].syscalls);
+		bench_syscalls(first, sizeof(first), results[i].syscalls_first);
+		printf("%-24s %9.1f %9.1f %9s %9s %8u %7llu %5u\n", name,
+				results[i].total_ns / 1000.0 / BENCH_CYCLES,
+				results[i].max_ns / 1000.0, steady, first,
+				results[i].estimate, results[i].bytes, results[i].jobs);
+	}
+
+	for (i = 0 ; i < BENCH_MODES ; i++) {
+		if (gadgets[i])
+			translator->cleanup_gadget(gadgets[i]);
+	}
+	bench_usb_gadget_hw_info.close(common);
+	bench_remove(BENCH_TREE);
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Pattern encoding of ir_transmit(): the per-call calloc and byte
+ * shifting it used to do, against ir_encode_pattern() which writes
+ * the int array as is on little endian hosts and converts it into a
+ * reused buffer elsewhere. Times are per encoded pattern.
+ */
+
+#include "../hw/ir/ir.c"
+
+#define BENCH_CARRIER   38000
+#define BENCH_WORK      20000000L  /* pulses encoded per measure */
+
+static const int bench_sizes[] = { 10, 50, 100, 250, 500, 1000 };
+
+static volatile uint8_t sink;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the encoding loop of the original ir_transmit() */
+static int legacy_encode(const int *frequency_pattern, int size)
+{
+	uint8_t *pattern;
+	uint32_t len;
+	int i, j = 0;
+
+	len = (size - 1) * 4;
+	pattern = (uint8_t *)calloc(1, sizeof(uint8_t) * len);
+	if (!pattern)
+		return -ENOMEM;
+	for (i = 1; i < size; i++) {
+		pattern[j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 0);
+		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 8);
+		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 16);
+		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 24);
+		j++;
+	}
+	sink = pattern[len - 1];
+	free(pattern);
+	return 0;
+}
+
+static int current_encode(struct ir_emitter *em, const int *frequency_pattern, int size)
+{
+	const uint8_t *pattern;
+
+	pattern = ir_encode_pattern(em, frequency_pattern + 1, size - 1);
+	if (!pattern)
+		return -ENOMEM;
+	sink = pattern[(size - 1) * 4 - 1];
+	return 0;
+}
+
+int main(void)
+{
+	struct ir_emitter em;
+	int *pattern;
+	uint64_t start;
+	double legacy_ns, current_ns;
+	long loops, l;
+	int i, s, size;
+
+	memset(&em, 0, sizeof(em));
+	em.fd = -1;
+
+	printf("%8s %12s %12s\n", "pulses", "legacy ns", "current ns");
+	for (s = 0 ; s < ARRAY_SIZE(bench_sizes) ; s++) {
+		size = bench_sizes[s] + 1;
+		pattern = malloc(size * sizeof(int));
+		if (!pattern)
+			return 1;
+		pattern[0] = BENCH_CARRIER;
+		for (i = 1 ; i < size ; i++)
+			pattern[i] = 560 * (1 + (i & 3));
+
+		loops = BENCH_WORK / bench_sizes[s];
+
+		start = bench_now();
+		for (l = 0 ; l < loops ; l++)
+			if (legacy_encode(pattern, size) < 0)
+				return 1;
+		legacy_ns = (double)(bench_now() - start) / loops;
+
+		start = bench_now();
+		for (l = 0 ; l < loops ; l++)
+			if (current_encode(&em, pattern, size) < 0)
+				return 1;
+		current_ns = (double)(bench_now() - start) / loops;
+
+		printf("%8d %12.1f %12.1f\n", bench_sizes[s], legacy_ns, current_ns);
+		free(pattern);
+	}
+
+	ir_release_pattern(&em);
+	return 0;
+}
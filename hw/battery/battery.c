@@ -28,6 +28,9 @@
 #include <hw/shared.h>
 #include "../udev.h"
 
+#define TRACE_MODULE "battery"
+#include "../trace.h"
+
 #define BATTERY_ROOT_PATH "/sys/class/power_supply"
 #define CHARGER_PATH      "/sys/class/extcon/max77843-muic/state"
 
@@ -41,12 +44,15 @@ static int get_power_source(char **src)
 	int val;
 	FILE *fp;
 	char buf[256];
+	long len = 0;
 
 	if (!src)
 		return -EINVAL;
 
+	TRACE_BEGIN(t);
 	fp = fopen(CHARGER_PATH, "r");
 	if (!fp) {
+		TRACE_SYSFS_READ(CHARGER_PATH, t, -errno);
 		_E("Failed to open power source path(%d)", errno);
 		return -errno;
 	}
@@ -54,6 +60,7 @@ static int get_power_source(char **src)
 	*src = POWER_SOURCE_NONE;
 
 	while (fgets(buf, sizeof(buf), fp)) {
+		len += strlen(buf);
 		if (strstr(buf, "USB=")) {
 			val = atoi(buf + 4); /* 4 == "USB=" */
 			if (val == 0)
@@ -72,6 +79,7 @@ static int get_power_source(char **src)
 	}
 
 	fclose(fp);
+	TRACE_SYSFS_READ(CHARGER_PATH, t, len);
 
 	return 0;
 }
@@ -190,10 +198,12 @@ static int battery_register_changed_event(
 {
 	int ret;
 
+	TRACE_OP("battery_register_changed_event");
+
 	ret = uevent_control_kernel_start();
 	if (ret < 0) {
 		_E("Failed to register uevent handler (%d)", ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 
 	ret = register_kernel_event_control(&uh);
@@ -206,12 +216,14 @@ static int battery_register_changed_event(
 	} else
 		_E("update callback is already registered");
 
-	return ret;
+	return TRACE_RET(ret);
 }
 
 static void battery_unregister_changed_event(
 		BatteryUpdated updated_cb)
 {
+	TRACE_OP("battery_unregister_changed_event");
+
 	unregister_kernel_event_control(&uh);
 	uevent_control_kernel_stop();
 	udata.updated_cb = NULL;
@@ -228,8 +240,10 @@ static int battery_get_current_state(
 	char health[32];
 	char *power_source;
 
+	TRACE_OP("battery_get_current_state");
+
 	if (!updated_cb)
-		return -EINVAL;
+		return TRACE_RET(-EINVAL);
 
 	info.name = BATTERY_HARDWARE_DEVICE_ID;
 
@@ -237,7 +251,7 @@ static int battery_get_current_state(
 	ret = sys_get_str(path, status, sizeof(status));
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	remove_not_string(status);
 	info.status = status;
@@ -246,7 +260,7 @@ static int battery_get_current_state(
 	ret = sys_get_str(path, health, sizeof(health));
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	remove_not_string(health);
 	info.health = health;
@@ -254,7 +268,7 @@ static int battery_get_current_state(
 	ret = get_power_source(&power_source);
 	if (ret < 0) {
 		_E("Failed to get power source (%d)", ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	remove_not_string(power_source);
 	info.power_source = power_source;
@@ -263,7 +277,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.online = val;
 
@@ -271,7 +285,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.present = val;
 
@@ -279,7 +293,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.capacity = val;
 
@@ -287,7 +301,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.current_now = val;
 
@@ -297,7 +311,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.voltage_now = val;
 
@@ -307,7 +321,7 @@ static int battery_get_current_state(
 	ret = sys_get_int(path, &val);
 	if (ret < 0) {
 		_E("Failed to get value of (%s, %d)", path, ret);
-		return ret;
+		return TRACE_RET(ret);
 	}
 	info.temperature = val;
 
@@ -21,36 +21,214 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 
+#include "board_ext.h"
+
+#define TRACE_MODULE "board"
+#include "../trace.h"
+
+#ifndef MMC_ID_PATH
 #define MMC_ID_PATH "/sys/class/mmc_host/mmc0/mmc0:0001/cid"
+#endif
+#ifndef DT_MODEL_PATH
+#define DT_MODEL_PATH "/proc/device-tree/model"
+#endif
+#ifndef DT_SERIAL_PATH
+#define DT_SERIAL_PATH "/proc/device-tree/serial-number"
+#endif
+#ifndef SOC_REVISION_PATH
+#define SOC_REVISION_PATH "/sys/devices/soc0/revision"
+#endif
+#ifndef CPUINFO_PATH
+#define CPUINFO_PATH "/proc/cpuinfo"
+#endif
+
 #define SERIAL_OFFSET 16
 #define SERIAL_LEN 16
-#define LINE_LEN (SERIAL_OFFSET + SERIAL_LEN + 2)
+#define CID_LEN 32
+#define ID_LEN 128
 
-static int get_device_serial(char **out)
+/* Storage of the identity, filled by board_identity_load() */
+static struct {
+	char serial[SERIAL_LEN + 1];
+	char mmc_cid[CID_LEN + 1];
+	char model[ID_LEN];
+	char dt_serial[ID_LEN];
+	char soc_revision[ID_LEN];
+} identity_buf;
+
+static struct board_identity identity;
+static bool serial_valid;
+static int refcount;
+
+/* the device tree is read through procfs, the rest through sysfs */
+static void trace_id_read(const char *path, uint64_t t, long result)
+{
+	if (!strncmp(path, "/proc/", 6))
+		TRACE_PROC_READ(path, t, result);
+	else
+		TRACE_SYSFS_READ(path, t, result);
+}
+
+/* Read a whole sysfs/procfs string, stripping the trailing NUL and blanks */
+static void read_id(const char *path, char *buf, size_t size)
 {
 	FILE *fp;
-	char line[LINE_LEN], *p;
+	size_t n;
 
-	fp = fopen(MMC_ID_PATH, "r");
-	if (!fp)
-		return -1;
+	buf[0] = '\0';
+	TRACE_BEGIN(t);
+	fp = fopen(path, "r");
+	if (!fp) {
+		trace_id_read(path, t, -errno);
+		return;
+	}
 
-	p = fgets(line, LINE_LEN, fp);
+	n = fread(buf, 1, size - 1, fp);
 	fclose(fp);
-	if (p == NULL)
-		return -1;
+	trace_id_read(path, t, n);
+	buf[n] = '\0';
+
+	/* device tree strings carry their own terminating NUL */
+	n = strlen(buf);
+	while (n > 0 && isspace((unsigned char)buf[n - 1]))
+		buf[--n] = '\0';
+}
+
+/* Fallback for kernels without the soc bus */
+static void read_cpuinfo_revision(char *buf, size_t size)
+{
+	FILE *fp;
+	char line[256], *p;
+	size_t n;
+	long len = 0;
+
+	TRACE_BEGIN(t);
+	fp = fopen(CPUINFO_PATH, "r");
+	if (!fp) {
+		TRACE_PROC_READ(CPUINFO_PATH, t, -errno);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		len += strlen(line);
+		if (strncmp(line, "Revision", 8))
+			continue;
+		p = strchr(line, ':');
+		if (!p)
+			break;
+		p++;
+		while (isspace((unsigned char)*p))
+			p++;
+		n = strcspn(p, "\n");
+		if (n >= size)
+			n = size - 1;
+		memcpy(buf, p, n);
+		buf[n] = '\0';
+		break;
+	}
+	fclose(fp);
+	TRACE_PROC_READ(CPUINFO_PATH, t, len);
+}
+
+static void board_identity_load(void)
+{
+	read_id(MMC_ID_PATH, identity_buf.mmc_cid, sizeof(identity_buf.mmc_cid));
+	serial_valid = (strlen(identity_buf.mmc_cid) >= SERIAL_OFFSET + SERIAL_LEN);
+	if (serial_valid)
+		memcpy(identity_buf.serial,
+				identity_buf.mmc_cid + SERIAL_OFFSET, SERIAL_LEN);
+	identity_buf.serial[SERIAL_LEN] = '\0';
+
+	read_id(DT_MODEL_PATH, identity_buf.model, sizeof(identity_buf.model));
+	read_id(DT_SERIAL_PATH, identity_buf.dt_serial, sizeof(identity_buf.dt_serial));
+	read_id(SOC_REVISION_PATH, identity_buf.soc_revision,
+			sizeof(identity_buf.soc_revision));
+	if (!identity_buf.soc_revision[0])
+		read_cpuinfo_revision(identity_buf.soc_revision,
+				sizeof(identity_buf.soc_revision));
+
+	identity.serial = identity_buf.serial;
+	identity.mmc_cid = identity_buf.mmc_cid;
+	identity.model = identity_buf.model;
+	identity.dt_serial = identity_buf.dt_serial;
+	identity.soc_revision = identity_buf.soc_revision;
+}
+
+static int get_device_serial(char **out)
+{
+	TRACE_OP("get_device_serial");
+
+	if (!out)
+		return TRACE_RET(-EINVAL);
+	if (!serial_valid)
+		return TRACE_RET(-1);
 
-	*out = strndup(line + SERIAL_OFFSET, SERIAL_LEN);
+	/* the caller owns the result in the hw_board interface */
+	*out = strdup(identity.serial);
+	if (!*out)
+		return TRACE_RET(-ENOMEM);
+	return 0;
+}
+
+static int get_identity(const struct board_identity **out)
+{
+	TRACE_OP("get_identity");
+
+	if (!out)
+		return TRACE_RET(-EINVAL);
+
+	*out = &identity;
+	return 0;
+}
+
+static int get_serial(const char **serial)
+{
+	TRACE_OP("get_serial");
+
+	if (!serial)
+		return TRACE_RET(-EINVAL);
+	if (!serial_valid)
+		return TRACE_RET(-ENOENT);
+
+	*serial = identity.serial;
+	return 0;
+}
+
+static int get_model(const char **model)
+{
+	TRACE_OP("get_model");
+
+	if (!model)
+		return TRACE_RET(-EINVAL);
+	if (!identity.model[0])
+		return TRACE_RET(-ENOENT);
+
+	*model = identity.model;
+	return 0;
+}
+
+static int get_soc_revision(const char **revision)
+{
+	TRACE_OP("get_soc_revision");
+
+	if (!revision)
+		return TRACE_RET(-EINVAL);
+	if (!identity.soc_revision[0])
+		return TRACE_RET(-ENOENT);
+
+	*revision = identity.soc_revision;
 	return 0;
 }
 
 static int board_open(struct hw_info *info,
 		const char *id, struct hw_common **common)
 {
-	struct hw_board *b;
+	struct hw_board_ext *b;
 
 	if (!info || !common)
 		return -EINVAL;
@@ -59,23 +237,33 @@ static int board_open(struct hw_info *info,
 	if (!b)
 		return -ENOMEM;
 
-	b->common.info = info;
-	b->get_device_serial = get_device_serial;
+	if (refcount++ == 0)
+		board_identity_load();
+
+	b->dev.common.info = info;
+	b->dev.get_device_serial = get_device_serial;
+	b->get_identity = get_identity;
+	b->get_serial = get_serial;
+	b->get_model = get_model;
+	b->get_soc_revision = get_soc_revision;
 
-	*common = &b->common;
+	*common = &b->dev.common;
 	return 0;
 }
 
 static int board_close(struct hw_common *common)
 {
-	struct hw_board *b;
+	struct hw_board_ext *b;
 
 	if (!common)
 		return -EINVAL;
 
-	b = container_of(common, struct hw_board, common);
+	b = container_of(common, struct hw_board_ext, dev.common);
 	free(b);
 
+	if (refcount > 0)
+		refcount--;
+
 	return 0;
 }
 
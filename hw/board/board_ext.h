@@ -0,0 +1,55 @@
+/*
+ * libdevice-node
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __BOARD_EXT_H__
+#define __BOARD_EXT_H__
+
+#include <hw/board.h>
+
+/*
+ * Identity of the board, read once when the module is opened.
+ * Sources which are not present are empty strings, never NULL.
+ */
+struct board_identity {
+	const char *serial;       /* serial part of the MMC CID */
+	const char *mmc_cid;      /* whole MMC CID */
+	const char *model;        /* device tree model */
+	const char *dt_serial;    /* device tree serial-number */
+	const char *soc_revision;
+};
+
+/*
+ * Pico specific board device.
+ * board_open() always returns this structure, so callers which know
+ * about the extension can cast the returned hw_common to it.
+ */
+struct hw_board_ext {
+	struct hw_board dev;
+
+	/*
+	 * The returned structure and strings are owned by the module and
+	 * stay valid until the last board device is closed. Do not free.
+	 */
+	int (*get_identity)(const struct board_identity **identity);
+	int (*get_serial)(const char **serial);
+	int (*get_model)(const char **model);
+	int (*get_soc_revision)(const char **revision);
+};
+
+#endif /* __BOARD_EXT_H__ */
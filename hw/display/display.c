@@ -19,12 +19,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
 #include <linux/limits.h>
+#include <glib.h>
 
 #include <hw/display.h>
 #include <hw/shared.h>
+#include "display_ext.h"
+#include "../udev.h"
+
+#define TRACE_MODULE "display"
+#include "../trace.h"
 
 #ifndef BACKLIGHT_PATH
 #define BACKLIGHT_PATH  "/sys/class/backlight/backlight_mipi"
@@ -34,21 +46,393 @@
 #define LCD_PATH  "/sys/class/drm/card0-DSI-1"
 #endif
 
-static int display_get_max_brightness(int *val)
+#define BACKLIGHT_ROOT_PATH "/sys/class/backlight"
+#define DRM_ROOT_PATH       "/sys/class/drm"
+
+/* the devices above are preferred if present */
+#define BACKLIGHT_NAME      (strrchr(BACKLIGHT_PATH, '/') + 1)
+#define LCD_NAME            (strrchr(LCD_PATH, '/') + 1)
+
+#define RAMP_INTERVAL_MS    16
+#define CURVE_STEPS         256
+#define CURVE_ONE           65536
+
+static int display_refcnt;
+
+struct backlight_info {
+	char *name;
+	int rank;
+	int max;
+	int fd;      /* brightness node, kept open */
+	int current; /* last actual_brightness, -1 if unknown */
+	int written; /* last value written to brightness, -1 if none */
+};
+
+struct connector_info {
+	char *name;
+	int rank;
+	char *dpms;  /* path of the dpms node */
+	int fd;      /* dpms node, kept open */
+};
+
+/* Devices found by display_open(), the preferred ones first */
+static struct display_devices {
+	struct backlight_info *backlights;
+	int nr_backlights;
+	struct connector_info *connectors;
+	int nr_connectors;
+} devs;
+
+static struct backlight_info no_backlight = {
+	.max = -1,
+	.fd = -1,
+	.current = -1,
+	.written = -1,
+};
+
+static struct connector_info no_connector = {
+	.fd = -1,
+};
+
+/* panel 0, used by the display_device interface and the ramp */
+static struct backlight_info *backlight = &no_backlight;
+static struct connector_info *lcd = &no_connector;
+
+/*
+ * The brightness is kept up to date by backlight uevents. DPMS changes
+ * send no uevent, so the state is always read from the connector and
+ * only drm hotplugs are checked for a state change.
+ */
+static struct display_cache {
+	bool monitored;
+	int lcd_state;  /* last valid state read, negative if none yet */
+	DisplayChanged changed_cb;
+	void *data;
+} cache;
+
+static struct ramp_info {
+	int timerfd;
+	GIOChannel *ch;
+	guint eventid;
+	bool running;
+	enum display_ramp_curve curve;
+	gint64 start_time;
+	gint64 duration; /* us */
+	int from;     /* start point, in curve space */
+	int to;       /* end point, in curve space */
+	int target;   /* brightness to reach */
+} ramp = {
+	.timerfd = -1,
+};
+
+/*
+ * Luminance (0 ~ CURVE_ONE) of each step of perceived lightness,
+ * using the CIE 1976 lightness function.
+ */
+static int lightness_curve[CURVE_STEPS];
+
+static void display_init_curve(void)
 {
-	static int max = -1;
+	double l, y;
+	int i;
+
+	for (i = 0 ; i < CURVE_STEPS ; i++) {
+		l = (double)i / (CURVE_STEPS - 1);
+		if (l <= 0.08)
+			y = l / 9.033;
+		else {
+			y = (l + 0.16) / 1.16;
+			y = y * y * y;
+		}
+		lightness_curve[i] = (int)(y * CURVE_ONE + 0.5);
+	}
+}
+
+static int backlight_rank(const char *name)
+{
+	char path[PATH_MAX];
+	char type[16];
+
+	if (!strcmp(name, BACKLIGHT_NAME))
+		return 0;
+
+	/* same order as the kernel recommends to pick a backlight */
+	snprintf(path, sizeof(path), "%s/%s/type", BACKLIGHT_ROOT_PATH, name);
+	if (sys_get_str(path, type, sizeof(type)) < 0)
+		return 4;
+	if (!strncmp(type, "firmware", 8))
+		return 1;
+	if (!strncmp(type, "platform", 8))
+		return 2;
+	if (!strncmp(type, "raw", 3))
+		return 3;
+	return 4;
+}
+
+static int backlight_init(struct backlight_info *bl, const char *name)
+{
+	char path[PATH_MAX];
 	int r;
 
-	if (!val)
+	snprintf(path, sizeof(path), "%s/%s/max_brightness", BACKLIGHT_ROOT_PATH, name);
+	r = sys_get_int(path, &bl->max);
+	if (r < 0) {
+		_E("fail to get max brightness of %s (errno:%d)", name, r);
+		return r;
+	}
+	if (bl->max <= 0) {
+		_E("invalid max brightness of %s (%d)", name, bl->max);
 		return -EINVAL;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s/brightness", BACKLIGHT_ROOT_PATH, name);
+	bl->fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (bl->fd < 0) {
+		_E("fail to open backlight %s (errno:%d)", name, errno);
+		return -errno;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s/actual_brightness", BACKLIGHT_ROOT_PATH, name);
+	r = sys_get_int(path, &bl->current);
+	if (r < 0)
+		bl->current = -1;
+	bl->written = -1;
+
+	bl->name = strdup(name);
+	if (!bl->name) {
+		close(bl->fd);
+		return -ENOMEM;
+	}
+
+	bl->rank = backlight_rank(name);
+	return 0;
+}
+
+static int connector_rank(const char *name)
+{
+	static const char *internal[] = { "-DSI-", "-eDP-", "-LVDS-", "-DPI-" };
+	int i;
+
+	if (!strcmp(name, LCD_NAME))
+		return 0;
+
+	for (i = 0 ; i < ARRAY_SIZE(internal) ; i++) {
+		if (strstr(name, internal[i]))
+			return 1;
+	}
+
+	return 2;
+}
+
+static int connector_init(struct connector_info *c, const char *name)
+{
+	char path[PATH_MAX];
+
+	/* cards and render nodes have no dpms */
+	snprintf(path, sizeof(path), "%s/%s/dpms", DRM_ROOT_PATH, name);
+	if (access(path, R_OK))
+		return -ENOENT;
+
+	c->dpms = strdup(path);
+	c->name = strdup(name);
+	if (!c->dpms || !c->name) {
+		free(c->dpms);
+		free(c->name);
+		return -ENOMEM;
+	}
+
+	c->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (c->fd < 0)
+		_E("fail to open %s (errno:%d)", path, errno);
+
+	c->rank = connector_rank(name);
+	return 0;
+}
+
+static int compare_backlight(const void *a, const void *b)
+{
+	const struct backlight_info *ba = a;
+	const struct backlight_info *bb = b;
+
+	if (ba->rank != bb->rank)
+		return ba->rank - bb->rank;
+	return strcmp(ba->name, bb->name);
+}
+
+static int compare_connector(const void *a, const void *b)
+{
+	const struct connector_info *ca = a;
+	const struct connector_info *cb = b;
+
+	if (ca->rank != cb->rank)
+		return ca->rank - cb->rank;
+	return strcmp(ca->name, cb->name);
+}
+
+/* grow 'array' of 'size' elements so that one more fits after 'nr' */
+static int display_reserve(void **array, int *size, int nr, size_t elem)
+{
+	void *p;
+
+	if (nr < *size)
+		return 0;
+
+	p = realloc(*array, elem * (*size ? *size * 2 : 4));
+	if (!p)
+		return -ENOMEM;
+
+	*array = p;
+	*size = *size ? *size * 2 : 4;
+	return 0;
+}
+
+static int display_scan_backlights(void)
+{
+	DIR *d;
+	struct dirent *dir;
+	int size = 0;
+
+	d = opendir(BACKLIGHT_ROOT_PATH);
+	if (!d)
+		return -errno;
 
-	if (max < 0) {
-		r = sys_get_int(BACKLIGHT_PATH"/max_brightness", &max);
-		if (r < 0)
-			return r;
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.')
+			continue;
+		if (display_reserve((void **)&devs.backlights, &size,
+				devs.nr_backlights, sizeof(struct backlight_info)) < 0)
+			break;
+		if (backlight_init(&devs.backlights[devs.nr_backlights], dir->d_name) < 0)
+			continue;
+		devs.nr_backlights++;
 	}
+	closedir(d);
 
-	*val = max;
+	qsort(devs.backlights, devs.nr_backlights,
+			sizeof(struct backlight_info), compare_backlight);
+	return 0;
+}
+
+static int display_scan_connectors(void)
+{
+	DIR *d;
+	struct dirent *dir;
+	int size = 0;
+
+	d = opendir(DRM_ROOT_PATH);
+	if (!d)
+		return -errno;
+
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.' || !strchr(dir->d_name, '-'))
+			continue;
+		if (display_reserve((void **)&devs.connectors, &size,
+				devs.nr_connectors, sizeof(struct connector_info)) < 0)
+			break;
+		if (connector_init(&devs.connectors[devs.nr_connectors], dir->d_name) < 0)
+			continue;
+		devs.nr_connectors++;
+	}
+	closedir(d);
+
+	qsort(devs.connectors, devs.nr_connectors,
+			sizeof(struct connector_info), compare_connector);
+	return 0;
+}
+
+static void display_exit_devices(void)
+{
+	int i;
+
+	for (i = 0 ; i < devs.nr_backlights ; i++) {
+		close(devs.backlights[i].fd);
+		free(devs.backlights[i].name);
+	}
+	for (i = 0 ; i < devs.nr_connectors ; i++) {
+		if (devs.connectors[i].fd >= 0)
+			close(devs.connectors[i].fd);
+		free(devs.connectors[i].dpms);
+		free(devs.connectors[i].name);
+	}
+	free(devs.backlights);
+	free(devs.connectors);
+	memset(&devs, 0, sizeof(devs));
+
+	backlight = &no_backlight;
+	lcd = &no_connector;
+}
+
+static void display_init_devices(void)
+{
+	int i;
+
+	if (display_scan_backlights() < 0)
+		_E("fail to scan %s", BACKLIGHT_ROOT_PATH);
+	if (display_scan_connectors() < 0)
+		_E("fail to scan %s", DRM_ROOT_PATH);
+
+	if (devs.nr_backlights > 0)
+		backlight = &devs.backlights[0];
+	if (devs.nr_connectors > 0)
+		lcd = &devs.connectors[0];
+
+	for (i = 0 ; i < devs.nr_backlights || i < devs.nr_connectors ; i++)
+		_I("panel %d: backlight (%s), connector (%s)", i,
+				i < devs.nr_backlights ? devs.backlights[i].name : "none",
+				i < devs.nr_connectors ? devs.connectors[i].name : "none");
+
+	display_init_curve();
+}
+
+/*
+ * The cached brightness only comes from actual_brightness, here and in
+ * the backlight uevents, so that it never mixes with requested values.
+ */
+static int display_read_brightness(struct backlight_info *bl, int *brightness)
+{
+	char path[PATH_MAX];
+	int r;
+
+	if (!bl->name)
+		return -ENODEV;
+
+	snprintf(path, sizeof(path), "%s/%s/actual_brightness", BACKLIGHT_ROOT_PATH, bl->name);
+	r = sys_get_int(path, brightness);
+	if (r < 0)
+		return r;
+
+	bl->current = *brightness;
+	return 0;
+}
+
+static int display_write_brightness(struct backlight_info *bl, int brightness)
+{
+	char buf[16];
+	int len;
+	ssize_t n;
+
+	len = snprintf(buf, sizeof(buf), "%d", brightness);
+	TRACE_BEGIN(t);
+	n = pwrite(bl->fd, buf, len, 0);
+	TRACE_SYSFS_WRITE(bl->name, t, n);
+	if (n < 0)
+		return -errno;
+
+	bl->written = brightness;
+	return 0;
+}
+
+static int display_get_max_brightness(int *val)
+{
+	TRACE_OP("display_get_max_brightness");
+
+	if (!val)
+		return TRACE_RET(-EINVAL);
+
+	if (backlight->max < 0)
+		return TRACE_RET(-ENODEV);
+
+	*val = backlight->max;
 	return 0;
 }
 
@@ -56,37 +440,54 @@ static int display_get_brightness(int *brightness)
 {
 	int r, v;
 
+	TRACE_OP("display_get_brightness");
+
 	if (!brightness) {
 		_E("wrong parameter");
-		return -EINVAL;
+		return TRACE_RET(-EINVAL);
 	}
 
-	r = sys_get_int(BACKLIGHT_PATH"/brightness", &v);
+	if (cache.monitored && backlight->current >= 0) {
+		*brightness = backlight->current;
+		return 0;
+	}
+
+	r = display_read_brightness(backlight, &v);
 	if (r < 0) {
 		_E("fail to get brightness (errno:%d)", r);
-		return r;
+		return TRACE_RET(r);
 	}
 
 	*brightness = v;
 	return 0;
 }
 
-static int display_set_brightness(int brightness)
+static void ramp_stop(void)
 {
-	int r, max;
+	struct itimerspec its = { { 0, }, };
 
-	r = display_get_max_brightness(&max);
-	if (r < 0) {
-		_E("fail to get max brightness (errno:%d)", r);
-		return r;
-	}
+	if (!ramp.running)
+		return;
+
+	timerfd_settime(ramp.timerfd, 0, &its, NULL);
+	ramp.running = false;
+}
+
+static int display_set_brightness_impl(int brightness)
+{
+	int r;
+
+	if (backlight->fd < 0)
+		return -ENODEV;
 
-	if (brightness < 0 || brightness > max) {
+	if (brightness < 0 || brightness > backlight->max) {
 		_E("wrong parameter");
 		return -EINVAL;
 	}
 
-	r = sys_set_int(BACKLIGHT_PATH"/brightness", brightness);
+	ramp_stop();
+
+	r = display_write_brightness(backlight, brightness);
 	if (r < 0) {
 		_E("fail to set brightness (errno:%d)", r);
 		return r;
@@ -95,45 +496,520 @@ static int display_set_brightness(int brightness)
 	return 0;
 }
 
-static int display_get_state(enum display_state *state)
+static int display_set_brightness(int brightness)
 {
-	int r;
-	char status[32];
+	TRACE_OP("display_set_brightness");
+
+	return TRACE_RET(display_set_brightness_impl(brightness));
+}
+
+/* brightness -> position on the curve (0 ~ CURVE_ONE) */
+static int curve_from_brightness(enum display_ramp_curve curve, int brightness)
+{
+	int y, lo, hi, mid;
+
+	y = (int)((gint64)brightness * CURVE_ONE / backlight->max);
+	if (curve == DISPLAY_RAMP_LINEAR)
+		return y;
+
+	lo = 0;
+	hi = CURVE_STEPS - 1;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (lightness_curve[mid] < y)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (int)((gint64)lo * CURVE_ONE / (CURVE_STEPS - 1));
+}
+
+/* position on the curve (0 ~ CURVE_ONE) -> brightness */
+static int curve_to_brightness(enum display_ramp_curve curve, int pos)
+{
+	int idx, frac, y;
+
+	if (curve == DISPLAY_RAMP_LINEAR)
+		y = pos;
+	else {
+		idx = (int)((gint64)pos * (CURVE_STEPS - 1) / CURVE_ONE);
+		if (idx >= CURVE_STEPS - 1)
+			y = lightness_curve[CURVE_STEPS - 1];
+		else {
+			frac = (int)((gint64)pos * (CURVE_STEPS - 1) % CURVE_ONE);
+			y = lightness_curve[idx] + (int)((gint64)frac *
+				(lightness_curve[idx + 1] - lightness_curve[idx]) / CURVE_ONE);
+		}
+	}
+
+	return (int)(((gint64)y * backlight->max + CURVE_ONE / 2) / CURVE_ONE);
+}
+
+/* the brightness the running ramp is at now */
+static int ramp_brightness_now(void)
+{
+	gint64 elapsed;
+	int pos;
 
-	r = sys_get_str(LCD_PATH"/dpms", status, sizeof(status));
+	elapsed = g_get_monotonic_time() - ramp.start_time;
+	if (elapsed >= ramp.duration)
+		return ramp.target;
+
+	pos = ramp.from + (int)((gint64)(ramp.to - ramp.from) * elapsed / ramp.duration);
+	return curve_to_brightness(ramp.curve, pos);
+}
+
+static gboolean ramp_timer_expired(GIOChannel *channel,
+		GIOCondition cond, void *data)
+{
+	uint64_t expired;
+	int brt, r;
+
+	if (read(ramp.timerfd, &expired, sizeof(expired)) < 0)
+		return TRUE;
+
+	if (!ramp.running)
+		return TRUE;
+
+	brt = ramp_brightness_now();
+	if (g_get_monotonic_time() - ramp.start_time >= ramp.duration)
+		ramp_stop();
+
+	/* consecutive steps often map to the same level */
+	if (brt == backlight->written)
+		return TRUE;
+
+	r = display_write_brightness(backlight, brt);
 	if (r < 0) {
-		_E("fail to get state (errno:%d)", r);
-		return r;
+		_E("fail to set brightness (errno:%d)", r);
+		ramp_stop();
+	}
+
+	return TRUE;
+}
+
+static int ramp_init(void)
+{
+	if (ramp.timerfd >= 0)
+		return 0;
+
+	ramp.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ramp.timerfd < 0) {
+		_E("fail to create ramp timer (errno:%d)", errno);
+		return -errno;
+	}
+
+	ramp.ch = g_io_channel_unix_new(ramp.timerfd);
+	ramp.eventid = g_io_add_watch(ramp.ch, G_IO_IN, ramp_timer_expired, NULL);
+	if (ramp.eventid == 0) {
+		_E("Failed to add ramp timer watch");
+		g_io_channel_unref(ramp.ch);
+		ramp.ch = NULL;
+		close(ramp.timerfd);
+		ramp.timerfd = -1;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void ramp_exit(void)
+{
+	ramp_stop();
+	if (ramp.eventid) {
+		g_source_remove(ramp.eventid);
+		ramp.eventid = 0;
+	}
+	if (ramp.ch) {
+		g_io_channel_unref(ramp.ch);
+		ramp.ch = NULL;
+	}
+	if (ramp.timerfd >= 0) {
+		close(ramp.timerfd);
+		ramp.timerfd = -1;
+	}
+}
+
+static int display_ramp_brightness(int target, int duration_ms,
+		enum display_ramp_curve curve)
+{
+	struct itimerspec its;
+	int current, r;
+
+	TRACE_OP("display_ramp_brightness");
+
+	if (backlight->fd < 0 || backlight->max <= 0)
+		return TRACE_RET(-ENODEV);
+
+	if (target < 0 || target > backlight->max || duration_ms < 0)
+		return TRACE_RET(-EINVAL);
+
+	if (curve != DISPLAY_RAMP_LINEAR && curve != DISPLAY_RAMP_PERCEPTUAL)
+		return TRACE_RET(-EINVAL);
+
+	/* a running ramp is retargeted from where it is now */
+	if (ramp.running)
+		current = ramp_brightness_now();
+	else if (cache.monitored && backlight->current >= 0)
+		current = backlight->current;
+	else if (display_read_brightness(backlight, &current) < 0)
+		current = -1;
+
+	if (duration_ms == 0 || current < 0)
+		return TRACE_RET(display_set_brightness_impl(target));
+
+	r = ramp_init();
+	if (r < 0)
+		return TRACE_RET(r);
+
+	ramp.curve = curve;
+	ramp.target = target;
+	ramp.from = curve_from_brightness(curve, current);
+	ramp.to = curve_from_brightness(curve, target);
+	ramp.start_time = g_get_monotonic_time();
+	ramp.duration = (gint64)duration_ms * 1000;
+
+	if (ramp.running)
+		return 0;
+
+	its.it_value.tv_sec = 0;
+	its.it_value.tv_nsec = RAMP_INTERVAL_MS * 1000000L;
+	its.it_interval = its.it_value;
+	if (timerfd_settime(ramp.timerfd, 0, &its, NULL) < 0) {
+		_E("fail to start ramp timer (errno:%d)", errno);
+		return TRACE_RET(-errno);
 	}
+	ramp.running = true;
+
+	return 0;
+}
+
+static int display_stop_ramp(void)
+{
+	TRACE_OP("display_stop_ramp");
+
+	ramp_stop();
+	return 0;
+}
+
+static int display_read_state(struct connector_info *c)
+{
+	char status[32];
+	ssize_t n;
+
+	if (c->fd < 0)
+		return -ENODEV;
+
+	TRACE_BEGIN(t);
+	n = pread(c->fd, status, sizeof(status) - 1, 0);
+	TRACE_SYSFS_READ(c->dpms, t, n);
+	if (n < 0) {
+		_E("fail to get state (errno:%d)", errno);
+		return -errno;
+	}
+	status[n] = '\0';
 
 	//remap LCD state
-	if (!strncmp(status, "On", 2)) {
-		*state = DISPLAY_ON;
-	} else if (!strncmp(status, "Off", 3)) {
-		*state = DISPLAY_OFF;
-	} else
+	if (!strncmp(status, "On", 2))
+		return DISPLAY_ON;
+	else if (!strncmp(status, "Off", 3))
+		return DISPLAY_OFF;
+
+	return -EINVAL;
+}
+
+static int display_get_connector_state(struct connector_info *c,
+		enum display_state *state)
+{
+	int r;
+
+	if (!state)
+		return -EINVAL;
+
+	r = display_read_state(c);
+	if (r == -EINVAL) {
 		*state = -EINVAL;
+		return 0;
+	}
+	if (r < 0)
+		return r;
 
+	*state = r;
 	return 0;
 }
 
+static int display_get_state(enum display_state *state)
+{
+	TRACE_OP("display_get_state");
+
+	return TRACE_RET(display_get_connector_state(lcd, state));
+}
+
+/* Panels: the n-th backlight paired with the n-th connector */
+static int display_get_panel_count(int *count)
+{
+	TRACE_OP("display_get_panel_count");
+
+	if (!count)
+		return TRACE_RET(-EINVAL);
+
+	*count = MAX(devs.nr_backlights, devs.nr_connectors);
+	return 0;
+}
+
+static int display_get_panel_info(int index, struct display_panel_info *info)
+{
+	TRACE_OP("display_get_panel_info");
+
+	if (!info || index < 0 ||
+	    (index >= devs.nr_backlights && index >= devs.nr_connectors))
+		return TRACE_RET(-EINVAL);
+
+	memset(info, 0, sizeof(*info));
+	info->max_brightness = -1;
+	if (index < devs.nr_backlights) {
+		info->backlight = devs.backlights[index].name;
+		info->max_brightness = devs.backlights[index].max;
+	}
+	if (index < devs.nr_connectors)
+		info->connector = devs.connectors[index].name;
+
+	return 0;
+}
+
+static int display_get_panel_brightness(int index, int *brightness)
+{
+	struct backlight_info *bl;
+
+	TRACE_OP("display_get_panel_brightness");
+
+	if (!brightness || index < 0 || index >= devs.nr_backlights)
+		return TRACE_RET(-EINVAL);
+
+	bl = &devs.backlights[index];
+	if (cache.monitored && bl->current >= 0) {
+		*brightness = bl->current;
+		return 0;
+	}
+
+	return TRACE_RET(display_read_brightness(bl, brightness));
+}
+
+static int display_set_panel_brightness(int index, int brightness)
+{
+	struct backlight_info *bl;
+
+	TRACE_OP("display_set_panel_brightness");
+
+	if (index < 0 || index >= devs.nr_backlights)
+		return TRACE_RET(-EINVAL);
+
+	bl = &devs.backlights[index];
+	if (bl == backlight)
+		return TRACE_RET(display_set_brightness_impl(brightness));
+
+	if (brightness < 0 || brightness > bl->max)
+		return TRACE_RET(-EINVAL);
+
+	return TRACE_RET(display_write_brightness(bl, brightness));
+}
+
+static int display_get_panel_state(int index, enum display_state *state)
+{
+	TRACE_OP("display_get_panel_state");
+
+	if (index < 0 || index >= devs.nr_connectors)
+		return TRACE_RET(-EINVAL);
+
+	return TRACE_RET(display_get_connector_state(&devs.connectors[index], state));
+}
+
+/* nothing is sent until the state was read once */
+static void display_notify_changed(void)
+{
+	if (cache.changed_cb && cache.lcd_state >= 0)
+		cache.changed_cb(cache.lcd_state, backlight->current, cache.data);
+}
+
+static void backlight_uevent_delivered(struct udev_device *dev)
+{
+	struct backlight_info *bl = NULL;
+	const char *name, *val;
+	int i, brt, state;
+
+	name = udev_device_get_sysname(dev);
+	if (!name)
+		return;
+
+	for (i = 0 ; i < devs.nr_backlights ; i++) {
+		if (!strcmp(name, devs.backlights[i].name)) {
+			bl = &devs.backlights[i];
+			break;
+		}
+	}
+	if (!bl)
+		return;
+
+	val = udev_device_get_sysattr_value(dev, "actual_brightness");
+	if (!val)
+		return;
+
+	brt = atoi(val);
+	if (brt == bl->current)
+		return;
+
+	bl->current = brt;
+	if (bl == backlight) {
+		state = display_read_state(lcd);
+		if (state >= 0)
+			cache.lcd_state = state;
+		display_notify_changed();
+	}
+}
+
+/* a hotplug may turn the connector off, dpms changes are not notified */
+static void drm_uevent_delivered(struct udev_device *dev)
+{
+	int state;
+
+	state = display_read_state(lcd);
+	if (state < 0 || state == cache.lcd_state)
+		return;
+
+	cache.lcd_state = state;
+	display_notify_changed();
+}
+
+static struct uevent_handler backlight_uh = {
+	.subsystem = "backlight",
+	.uevent_func = backlight_uevent_delivered,
+};
+
+static struct uevent_handler drm_uh = {
+	.subsystem = "drm",
+	.uevent_func = drm_uevent_delivered,
+};
+
+static void display_exit_monitor(void)
+{
+	if (!cache.monitored)
+		return;
+
+	unregister_kernel_event_control(&drm_uh);
+	unregister_kernel_event_control(&backlight_uh);
+	uevent_control_kernel_stop();
+	cache.monitored = false;
+}
+
+static int display_init_monitor(void)
+{
+	int ret;
+
+	ret = register_kernel_event_control(&backlight_uh);
+	if (ret < 0)
+		return ret;
+
+	ret = register_kernel_event_control(&drm_uh);
+	if (ret < 0) {
+		unregister_kernel_event_control(&backlight_uh);
+		return ret;
+	}
+
+	ret = uevent_control_kernel_start();
+	if (ret < 0) {
+		_E("Failed to start uevent control (%d)", ret);
+		unregister_kernel_event_control(&drm_uh);
+		unregister_kernel_event_control(&backlight_uh);
+		return ret;
+	}
+
+	cache.lcd_state = display_read_state(lcd);
+	cache.monitored = true;
+	return 0;
+}
+
+static int display_register_changed_event(DisplayChanged changed_cb, void *data)
+{
+	TRACE_OP("display_register_changed_event");
+
+	if (!changed_cb)
+		return TRACE_RET(-EINVAL);
+
+	if (!cache.monitored)
+		return TRACE_RET(-ENOTSUP);
+
+	if (cache.changed_cb) {
+		_E("change callback is already registered");
+		return TRACE_RET(-EEXIST);
+	}
+
+	cache.changed_cb = changed_cb;
+	cache.data = data;
+	return 0;
+}
+
+static void display_unregister_changed_event(DisplayChanged changed_cb)
+{
+	TRACE_OP("display_unregister_changed_event");
+
+	if (cache.changed_cb != changed_cb)
+		return;
+
+	cache.changed_cb = NULL;
+	cache.data = NULL;
+}
+
+static void display_init(void)
+{
+	if (display_refcnt++ > 0)
+		return;
+
+	display_init_devices();
+
+	if (display_init_monitor() < 0)
+		_E("display uevents are not available, state is not cached");
+}
+
+static void display_exit(void)
+{
+	if (--display_refcnt > 0)
+		return;
+
+	display_exit_monitor();
+	ramp_exit();
+	display_exit_devices();
+}
+
 static int display_open(struct hw_info *info,
 		const char *id, struct hw_common **common)
 {
+	struct display_device_ext *display_ext;
 	struct display_device *display_dev;
 
 	if (!info || !common)
 		return -EINVAL;
 
-	display_dev = calloc(1, sizeof(struct display_device));
-	if (!display_dev)
+	display_ext = calloc(1, sizeof(struct display_device_ext));
+	if (!display_ext)
 		return -ENOMEM;
 
+	display_init();
+
+	display_dev = &display_ext->dev;
 	display_dev->common.info = info;
 	display_dev->get_max_brightness = display_get_max_brightness;
 	display_dev->get_brightness = display_get_brightness;
 	display_dev->set_brightness = display_set_brightness;
 	display_dev->get_state = display_get_state;
+	display_ext->ramp_brightness = display_ramp_brightness;
+	display_ext->stop_ramp = display_stop_ramp;
+	display_ext->register_changed_event = display_register_changed_event;
+	display_ext->unregister_changed_event = display_unregister_changed_event;
+	display_ext->get_panel_count = display_get_panel_count;
+	display_ext->get_panel_info = display_get_panel_info;
+	display_ext->get_panel_brightness = display_get_panel_brightness;
+	display_ext->set_panel_brightness = display_set_panel_brightness;
+	display_ext->get_panel_state = display_get_panel_state;
 
 	*common = (struct hw_common *)display_dev;
 	return 0;
@@ -144,6 +1020,7 @@ static int display_close(struct hw_common *common)
 	if (!common)
 		return -EINVAL;
 
+	display_exit();
 	free(common);
 	return 0;
 }
@@ -0,0 +1,74 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2015 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __DISPLAY_EXT_H__
+#define __DISPLAY_EXT_H__
+
+#include <hw/display.h>
+
+enum display_ramp_curve {
+	DISPLAY_RAMP_LINEAR,
+	DISPLAY_RAMP_PERCEPTUAL, /* steps of equal perceived lightness */
+};
+
+/* Devices of a panel, NULL if the panel has no such device */
+struct display_panel_info {
+	const char *backlight;
+	const char *connector;
+	int max_brightness;
+};
+
+/*
+ * Called when the backlight of panel 0 changes, or when a hotplug changes
+ * its state. DPMS changes send no uevent and are not notified.
+ */
+typedef void (*DisplayChanged)(enum display_state state, int brightness, void *data);
+
+/*
+ * Pico specific display device.
+ * display_open() always returns this structure, so callers which know
+ * about the extension can cast the returned hw_common to it.
+ */
+struct display_device_ext {
+	struct display_device dev;
+
+	/*
+	 * Move the backlight to 'target' over 'duration_ms' in the main loop.
+	 * Calling it again while ramping retargets the running ramp.
+	 * set_brightness() cancels the ramp.
+	 */
+	int (*ramp_brightness)(int target, int duration_ms,
+			enum display_ramp_curve curve);
+	int (*stop_ramp)(void);
+
+	int (*register_changed_event)(DisplayChanged changed_cb, void *data);
+	void (*unregister_changed_event)(DisplayChanged changed_cb);
+
+	/*
+	 * Panels found at open, panel 0 is the one driven by display_device.
+	 * Backlights and drm connectors are paired in order of preference.
+	 */
+	int (*get_panel_count)(int *count);
+	int (*get_panel_info)(int index, struct display_panel_info *info);
+	int (*get_panel_brightness)(int index, int *brightness);
+	int (*set_panel_brightness)(int index, int brightness);
+	int (*get_panel_state)(int index, enum display_state *state);
+};
+
+#endif /* __DISPLAY_EXT_H__ */
@@ -27,12 +27,20 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <stdint.h>
+#include <endian.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <glib.h>
 
 #include <hw/ir.h>
 #include <hw/shared.h>
+#include "ir_ext.h"
+
+#define TRACE_MODULE "ir"
+#include "../trace.h"
 
 #define IRLED_CONTROL_PATH "/dev/lirc0"
+#define LIRC_DEV_PATH      "/dev"
 
 #define LIRC_GET_LENGTH		2147772687UL
 #define LIRC_SET_LENGTH		1074030864UL
@@ -40,11 +48,88 @@
 #define LIRC_SET_FREQUENCY	1074030885UL
 #define LIRC_GET_FEATURES	2147772672UL
 
-static int fd;
+#define LIRC_CAN_SEND_PULSE	0x00000002
+
+#define IR_QUEUE_MAX		16
+#define IR_MAX_MERGED		16 /* repeats merged into one request */
+#define IR_MAX_EMITTERS		32
+
+/* Completion of a request sent to several emitters by transmit_to() */
+struct broadcast {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending;
+	int result;
+};
+
+/* struct transmit_request is sent 'repeat' times by the worker */
+struct transmit_request {
+	int id;
+	int *pattern;
+	bool copied;   /* pattern is owned by the request */
+	int size;
+	int repeat;
+	int result;
+	IrTransmitDone done_cb;
+	void *data;
+	struct broadcast *bc;
+	guint idle;    /* completion source, once the request is done */
+};
+
+struct transmit_queue {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool started;
+	bool exit;
+	GList *list;   /* pending requests */
+	int nr;
+	int sending;   /* id of the request being sent, 0 if none */
+};
+
+/* A send capable LIRC device, with its own worker */
+struct ir_emitter {
+	char path[PATH_MAX];
+
+	/* The device is kept open between transmissions, lock serializes its use */
+	pthread_mutex_t lock;
+	int fd;
+
+	/* Last carrier and length programmed into the device, 0 if unknown */
+	uint32_t cur_freq;
+	uint32_t cur_len;
+
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+	/* LIRC expects little endian pulses, kept across transmissions */
+	uint32_t *pattern_buf;
+	size_t pattern_buf_size;
+#endif
+
+	struct transmit_queue queue;
+};
+
+/* Emitters found by ir_open(), the first one is used by default */
+static struct ir_emitter *emitters;
+static int nr_emitters;
+
+static pthread_mutex_t id_lock = PTHREAD_MUTEX_INITIALIZER;
+static int last_id;
+
+/* Requests whose completion is queued in the main loop */
+static struct {
+	pthread_mutex_t lock;
+	GList *list;
+} completions = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int ir_refcnt;
 
 static int ir_is_available(bool *available)
 {
-	if (!access(IRLED_CONTROL_PATH, W_OK))
+	TRACE_OP("ir_is_available");
+
+	if (nr_emitters > 0 && !access(emitters[0].path, W_OK))
 		*available = true;
 	else
 		*available = false;
@@ -52,86 +137,1042 @@ static int ir_is_available(bool *available)
 	return 0;
 }
 
-static int ir_transmit(int *frequency_pattern, int size)
+static void ir_device_close(struct ir_emitter *em)
 {
-	int i, j, ret;
-	uint32_t temp = 0;
-	uint32_t len = 0;
-	uint32_t freq;
-	ssize_t n;
-	uint8_t *pattern;
+	if (em->fd >= 0)
+		close(em->fd);
+	em->fd = -1;
+	em->cur_freq = 0;
+	em->cur_len = 0;
+}
 
-	if (size <= 1)
-		return -EINVAL;
+static int ir_device_open(struct ir_emitter *em)
+{
+	int ret;
 
-	if (!frequency_pattern)
-		return -EINVAL;
+	if (em->fd >= 0)
+		return 0;
 
-	fd = open(IRLED_CONTROL_PATH, O_RDWR);
-	if (fd < 0) {
+	em->fd = open(em->path, O_RDWR | O_CLOEXEC);
+	if (em->fd < 0) {
 		_E("Unable to open the device");
 		return -ENODEV;
 	}
-	ret = ioctl(fd, LIRC_GET_FREQUENCY, &temp);
-	if (ret < 0)
+
+	ret = ioctl(em->fd, LIRC_GET_FREQUENCY, &em->cur_freq);
+	if (ret < 0) {
 		_E("Failed to get frequency: %d", errno);
-	if (temp != frequency_pattern[0]) {
-		freq = frequency_pattern[0];
-		ret = ioctl(fd, LIRC_SET_FREQUENCY, &freq);
+		em->cur_freq = 0;
+	}
+
+	ret = ioctl(em->fd, LIRC_GET_LENGTH, &em->cur_len);
+	if (ret < 0) {
+		_E("Failed to get length: %d", errno);
+		em->cur_len = 0;
+	}
+
+	return 0;
+}
+
+/* Get the pulses of the pattern in the layout written to the device */
+static const void *ir_encode_pattern(struct ir_emitter *em, const int *pulses, int nr)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	/* an int array already is the byte stream LIRC expects */
+	return pulses;
+#else
+	uint32_t *buf;
+	size_t size;
+	int i;
+
+	if (em->pattern_buf_size < (size_t)nr) {
+		size = em->pattern_buf_size ? em->pattern_buf_size : 64;
+		while (size < (size_t)nr)
+			size *= 2;
+		buf = realloc(em->pattern_buf, size * sizeof(uint32_t));
+		if (!buf)
+			return NULL;
+		em->pattern_buf = buf;
+		em->pattern_buf_size = size;
+	}
+
+	/* plain loop, left to the compiler to vectorize */
+	for (i = 0 ; i < nr ; i++)
+		em->pattern_buf[i] = htole32((uint32_t)pulses[i]);
+
+	return em->pattern_buf;
+#endif
+}
+
+static void ir_release_pattern(struct ir_emitter *em)
+{
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+	free(em->pattern_buf);
+	em->pattern_buf = NULL;
+	em->pattern_buf_size = 0;
+#endif
+}
+
+/* em->lock must be held */
+static int ir_send(struct ir_emitter *em, const int *frequency_pattern, int size)
+{
+	int ret;
+	uint32_t len = 0;
+	uint32_t freq;
+	ssize_t n;
+	const void *pattern;
+
+	ret = ir_device_open(em);
+	if (ret < 0)
+		return ret;
+
+	freq = frequency_pattern[0];
+	if (em->cur_freq != freq) {
+		ret = ioctl(em->fd, LIRC_SET_FREQUENCY, &freq);
 		if (ret < 0) {
+			ret = -errno;
 			_E("Set frequency failed: %d", errno);
-			close(fd);
-			return -errno;
+			ir_device_close(em);
+			return ret;
 		}
+		em->cur_freq = freq;
 	}
 
-	len = (size - 1) * 4;
-	j = 0;
-	pattern  = (uint8_t *)calloc(1, sizeof(uint8_t) * len);
-	for (i = 1; i < size; i++) {
-		pattern[j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 0);
-		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 8);
-		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 16);
-		pattern[++j] = (uint8_t)(((unsigned int)frequency_pattern[i]) >> 24);
-		j++;
+	len = (size - 1) * sizeof(uint32_t);
+	pattern = ir_encode_pattern(em, frequency_pattern + 1, size - 1);
+	if (!pattern) {
+		_E("Failed to encode the pattern");
+		return -ENOMEM;
 	}
-	ret = ioctl(fd, LIRC_GET_LENGTH, &temp);
-	if (ret < 0)
-		_E("Failed to get length: %d", errno);
-	if (temp != len)
-		ret = ioctl(fd, LIRC_SET_LENGTH, &len);
 
-	n = write(fd, pattern, len);
-	free(pattern);
+	if (em->cur_len != len) {
+		ret = ioctl(em->fd, LIRC_SET_LENGTH, &len);
+		em->cur_len = (ret < 0) ? 0 : len;
+	}
+
+	TRACE_BEGIN(t);
+	n = write(em->fd, pattern, len);
+	TRACE_DEV_WRITE(em->path, t, n);
 	if (n < 0) {
+		ret = -errno;
 		_E("Unable to write to the device: %d", errno);
-		close(fd);
-		return -errno;
+		ir_device_close(em);
+		return ret;
 	} else if (n != len) {
 		_E("Failed to write everything wrote %d instead", n);
-		close(fd);
+		ir_device_close(em);
 		return -EINTR;
 	}
 
-	close(fd);
 	return 0;
 }
 
+static int ir_transmit_impl(int *frequency_pattern, int size)
+{
+	struct ir_emitter *em;
+	int ret;
+
+	if (size <= 1)
+		return -EINVAL;
+
+	if (!frequency_pattern)
+		return -EINVAL;
+
+	if (nr_emitters == 0)
+		return -ENODEV;
+
+	em = &emitters[0];
+	pthread_mutex_lock(&em->lock);
+	ret = ir_send(em, frequency_pattern, size);
+	pthread_mutex_unlock(&em->lock);
+
+	return ret;
+}
+
+static int ir_transmit(int *frequency_pattern, int size)
+{
+	TRACE_OP("ir_transmit");
+
+	return TRACE_RET(ir_transmit_impl(frequency_pattern, size));
+}
+
+static void transmit_request_free(struct transmit_request *req)
+{
+	if (req->copied)
+		free(req->pattern);
+	free(req);
+}
+
+/* main loop side of a finished request */
+static gboolean transmit_request_done(gpointer data)
+{
+	struct transmit_request *req = data;
+
+	pthread_mutex_lock(&completions.lock);
+	completions.list = g_list_remove(completions.list, req);
+	pthread_mutex_unlock(&completions.lock);
+
+	if (req->done_cb)
+		req->done_cb(req->id, req->result, req->data);
+
+	transmit_request_free(req);
+	return G_SOURCE_REMOVE;
+}
+
+/* hand the completion of an async request over to the main loop */
+static void transmit_request_queue_done(struct transmit_request *req)
+{
+	pthread_mutex_lock(&completions.lock);
+	req->idle = g_idle_add(transmit_request_done, req);
+	completions.list = g_list_prepend(completions.list, req);
+	pthread_mutex_unlock(&completions.lock);
+}
+
+/* drop the completions not run yet, their callers are gone */
+static void ir_release_completions(void)
+{
+	struct transmit_request *req;
+	GList *elem;
+
+	pthread_mutex_lock(&completions.lock);
+	for (elem = completions.list ; elem ; elem = g_list_next(elem)) {
+		req = elem->data;
+		g_source_remove(req->idle);
+		transmit_request_free(req);
+	}
+	g_list_free(completions.list);
+	completions.list = NULL;
+	pthread_mutex_unlock(&completions.lock);
+}
+
+static void transmit_request_complete(struct transmit_request *req)
+{
+	struct broadcast *bc = req->bc;
+
+	if (!bc) {
+		transmit_request_queue_done(req);
+		return;
+	}
+
+	/* transmit_to() is waiting for it */
+	pthread_mutex_lock(&bc->lock);
+	if (req->result < 0)
+		bc->result = req->result;
+	bc->pending--;
+	pthread_cond_broadcast(&bc->cond);
+	pthread_mutex_unlock(&bc->lock);
+	transmit_request_free(req);
+}
+
+static void *ir_worker(void *arg)
+{
+	struct ir_emitter *em = arg;
+	struct transmit_queue *queue = &em->queue;
+	struct transmit_request *req;
+	int repeat, ret;
+
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->exit) {
+		if (!queue->list) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+			continue;
+		}
+
+		req = queue->list->data;
+		queue->list = g_list_delete_link(queue->list, queue->list);
+		queue->nr--;
+		queue->sending = req->id;
+
+		/* the module may be closed between two repeats */
+		while (req->repeat > 0 && !queue->exit) {
+			req->repeat--;
+			pthread_mutex_unlock(&queue->lock);
+
+			pthread_mutex_lock(&em->lock);
+			ret = ir_send(em, req->pattern, req->size);
+			pthread_mutex_unlock(&em->lock);
+			if (ret < 0)
+				req->result = ret;
+
+			pthread_mutex_lock(&queue->lock);
+		}
+
+		queue->sending = 0;
+		repeat = req->repeat;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (repeat > 0)
+			req->result = -ECANCELED;
+		transmit_request_complete(req);
+
+		pthread_mutex_lock(&queue->lock);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+static void ir_stop_worker(struct ir_emitter *em)
+{
+	struct transmit_queue *queue = &em->queue;
+	struct transmit_request *req;
+	GList *elem;
+
+	if (!queue->started)
+		return;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->exit = true;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	for (elem = queue->list ; elem ; elem = g_list_next(elem)) {
+		req = elem->data;
+		req->result = -ECANCELED;
+		transmit_request_complete(req);
+	}
+	g_list_free(queue->list);
+	queue->list = NULL;
+	queue->nr = 0;
+	queue->exit = false;
+	queue->started = false;
+}
+
+/* the request which a new frame can be merged into, if any */
+static struct transmit_request *ir_find_repeat(struct transmit_queue *queue,
+		int *frequency_pattern, int size, IrTransmitDone done_cb, void *data)
+{
+	struct transmit_request *req;
+	GList *last;
+
+	last = g_list_last(queue->list);
+	if (!last)
+		return NULL;
+
+	req = last->data;
+	if (req->bc || req->repeat >= IR_MAX_MERGED || req->size != size ||
+	    req->done_cb != done_cb || req->data != data)
+		return NULL;
+	if (memcmp(req->pattern, frequency_pattern, sizeof(int) * size))
+		return NULL;
+
+	return req;
+}
+
+static int ir_new_id(void)
+{
+	int id;
+
+	pthread_mutex_lock(&id_lock);
+	if (++last_id <= 0)
+		last_id = 1;
+	id = last_id;
+	pthread_mutex_unlock(&id_lock);
+
+	return id;
+}
+
+static struct transmit_request *ir_new_request(int id,
+		int *frequency_pattern, int size, bool copy,
+		IrTransmitDone done_cb, void *data, struct broadcast *bc)
+{
+	struct transmit_request *req;
+
+	req = calloc(1, sizeof(struct transmit_request));
+	if (!req)
+		return NULL;
+	if (copy) {
+		req->pattern = malloc(sizeof(int) * size);
+		if (!req->pattern) {
+			free(req);
+			return NULL;
+		}
+		memcpy(req->pattern, frequency_pattern, sizeof(int) * size);
+		req->copied = true;
+	} else
+		req->pattern = frequency_pattern;
+	req->size = size;
+	req->repeat = 1;
+	req->done_cb = done_cb;
+	req->data = data;
+	req->bc = bc;
+	req->id = id;
+
+	return req;
+}
+
+/* check that 'em' can take one more request, queue->lock must be held */
+static int ir_queue_reserve(struct ir_emitter *em)
+{
+	struct transmit_queue *queue = &em->queue;
+	int r;
+
+	if (queue->nr >= IR_QUEUE_MAX)
+		return -EBUSY;
+
+	if (!queue->started) {
+		r = pthread_create(&queue->thread, NULL, ir_worker, em);
+		if (r != 0) {
+			_E("Failed to create ir worker (%d)", r);
+			return -r;
+		}
+		queue->started = true;
+	}
+
+	return 0;
+}
+
+/* queue->lock must be held */
+static void ir_queue_append(struct transmit_queue *queue,
+		struct transmit_request *req)
+{
+	queue->list = g_list_append(queue->list, req);
+	queue->nr++;
+	pthread_cond_broadcast(&queue->cond);
+}
+
+/*
+ * hand a request over to the worker of 'em', merging repeats if possible.
+ * A request takes at most IR_MAX_MERGED repeats, so the queue holds at
+ * most IR_QUEUE_MAX * IR_MAX_MERGED frames.
+ */
+static int ir_queue_request(struct ir_emitter *em, int id,
+		int *frequency_pattern, int size, bool copy,
+		IrTransmitDone done_cb, void *data, struct broadcast *bc, int *out_id)
+{
+	struct transmit_queue *queue = &em->queue;
+	struct transmit_request *req;
+	int r;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (!bc) {
+		req = ir_find_repeat(queue, frequency_pattern, size, done_cb, data);
+		if (req) {
+			req->repeat++;
+			goto out;
+		}
+	}
+
+	r = ir_queue_reserve(em);
+	if (r < 0) {
+		pthread_mutex_unlock(&queue->lock);
+		return r;
+	}
+
+	req = ir_new_request(id, frequency_pattern, size, copy, done_cb, data, bc);
+	if (!req) {
+		pthread_mutex_unlock(&queue->lock);
+		return -ENOMEM;
+	}
+	ir_queue_append(queue, req);
+out:
+	if (out_id)
+		*out_id = req->id;
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+/* the emitters of 'mask' which exist */
+static unsigned int ir_valid_mask(unsigned int mask)
+{
+	return mask & ((nr_emitters < IR_MAX_EMITTERS) ? (1U << nr_emitters) - 1 : ~0U);
+}
+
+/*
+ * A broadcast is queued on all the emitters of 'mask' or on none of them:
+ * every queue is held, in index order, until all of them accepted it.
+ */
+static int ir_transmit_to_async_impl(unsigned int mask, int *frequency_pattern, int size,
+		IrTransmitDone done_cb, void *data, int *id)
+{
+	struct transmit_request *reqs[IR_MAX_EMITTERS] = { NULL, };
+	int i, r = 0, new_id;
+
+	if (size <= 1 || !frequency_pattern || mask == 0)
+		return -EINVAL;
+
+	mask = ir_valid_mask(mask);
+	if (mask == 0)
+		return -ENODEV;
+
+	new_id = ir_new_id();
+
+	/* a single emitter may merge the frame into a queued repeat */
+	if (!(mask & (mask - 1)))
+		return ir_queue_request(&emitters[__builtin_ctz(mask)],
+				new_id, frequency_pattern, size, true, done_cb, data, NULL, id);
+
+	for (i = 0 ; i < nr_emitters ; i++) {
+		if (mask & (1U << i))
+			pthread_mutex_lock(&emitters[i].queue.lock);
+	}
+
+	for (i = 0 ; i < nr_emitters && r == 0 ; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+		r = ir_queue_reserve(&emitters[i]);
+		if (r < 0)
+			break;
+		reqs[i] = ir_new_request(new_id, frequency_pattern, size,
+				true, done_cb, data, NULL);
+		if (!reqs[i])
+			r = -ENOMEM;
+	}
+
+	for (i = 0 ; i < nr_emitters ; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+		if (r == 0)
+			ir_queue_append(&emitters[i].queue, reqs[i]);
+		else if (reqs[i])
+			transmit_request_free(reqs[i]);
+		pthread_mutex_unlock(&emitters[i].queue.lock);
+	}
+
+	if (r == 0 && id)
+		*id = new_id;
+	return r;
+}
+
+static int ir_transmit_to_async(unsigned int mask, int *frequency_pattern, int size,
+		IrTransmitDone done_cb, void *data, int *id)
+{
+	TRACE_OP("ir_transmit_to_async");
+
+	return TRACE_RET(ir_transmit_to_async_impl(mask, frequency_pattern, size,
+			done_cb, data, id));
+}
+
+static int ir_transmit_async(int *frequency_pattern, int size,
+		IrTransmitDone done_cb, void *data, int *id)
+{
+	TRACE_OP("ir_transmit_async");
+
+	return TRACE_RET(ir_transmit_to_async_impl(1, frequency_pattern, size,
+			done_cb, data, id));
+}
+
+/* Send to every emitter of 'mask' at once and wait for all of them */
+static int ir_transmit_to(unsigned int mask, int *frequency_pattern, int size)
+{
+	struct broadcast bc = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	int i, r, id;
+
+	TRACE_OP("ir_transmit_to");
+
+	if (size <= 1 || !frequency_pattern || mask == 0)
+		return TRACE_RET(-EINVAL);
+
+	mask = ir_valid_mask(mask);
+	if (mask == 0)
+		return TRACE_RET(-ENODEV);
+
+	/* no need to involve the workers for a single emitter */
+	if (!(mask & (mask - 1))) {
+		i = __builtin_ctz(mask);
+		pthread_mutex_lock(&emitters[i].lock);
+		r = ir_send(&emitters[i], frequency_pattern, size);
+		pthread_mutex_unlock(&emitters[i].lock);
+		return TRACE_RET(r);
+	}
+
+	id = ir_new_id();
+	for (i = 0 ; i < nr_emitters ; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+		pthread_mutex_lock(&bc.lock);
+		bc.pending++;
+		pthread_mutex_unlock(&bc.lock);
+		r = ir_queue_request(&emitters[i], id, frequency_pattern, size,
+				false, NULL, NULL, &bc, NULL);
+		if (r < 0) {
+			pthread_mutex_lock(&bc.lock);
+			bc.pending--;
+			bc.result = r;
+			pthread_mutex_unlock(&bc.lock);
+		}
+	}
+
+	pthread_mutex_lock(&bc.lock);
+	while (bc.pending > 0)
+		pthread_cond_wait(&bc.cond, &bc.lock);
+	pthread_mutex_unlock(&bc.lock);
+
+	return TRACE_RET(bc.result);
+}
+
+static int ir_get_emitter_count(int *count)
+{
+	TRACE_OP("ir_get_emitter_count");
+
+	if (!count)
+		return TRACE_RET(-EINVAL);
+
+	*count = nr_emitters;
+	return 0;
+}
+
+static int ir_cancel(int id)
+{
+	struct transmit_queue *queue;
+	struct transmit_request *req;
+	GList *elem, *next;
+	int i, ret = -ENOENT;
+
+	TRACE_OP("ir_cancel");
+
+	for (i = 0 ; i < nr_emitters ; i++) {
+		queue = &emitters[i].queue;
+		pthread_mutex_lock(&queue->lock);
+		if (id > 0 && id == queue->sending) {
+			pthread_mutex_unlock(&queue->lock);
+			if (ret == -ENOENT)
+				ret = -EBUSY;
+			continue;
+		}
+
+		for (elem = queue->list ; elem ; elem = next) {
+			next = g_list_next(elem);
+			req = elem->data;
+			if (req->id != id || req->bc)
+				continue;
+			queue->list = g_list_delete_link(queue->list, elem);
+			queue->nr--;
+			req->result = -ECANCELED;
+			transmit_request_queue_done(req);
+			ret = 0;
+		}
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	return TRACE_RET(ret);
+}
+
+static int ir_add_emitter(const char *path)
+{
+	struct ir_emitter *em, *p;
+
+	p = realloc(emitters, sizeof(struct ir_emitter) * (nr_emitters + 1));
+	if (!p)
+		return -ENOMEM;
+	emitters = p;
+
+	em = &emitters[nr_emitters];
+	memset(em, 0, sizeof(*em));
+	snprintf(em->path, sizeof(em->path), "%s", path);
+	pthread_mutex_init(&em->lock, NULL);
+	pthread_mutex_init(&em->queue.lock, NULL);
+	pthread_cond_init(&em->queue.cond, NULL);
+	em->fd = -1;
+	nr_emitters++;
+
+	_I("IR emitter %d (%s)", nr_emitters - 1, path);
+	return 0;
+}
+
+static int compare_path(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Find the LIRC devices which can send, /dev/lirc0 first */
+static void ir_scan_emitters(void)
+{
+	DIR *d;
+	struct dirent *dir;
+	char *found[IR_MAX_EMITTERS];
+	char path[PATH_MAX];
+	uint32_t features;
+	int i, nr = 0, fd;
+
+	d = opendir(LIRC_DEV_PATH);
+	if (d) {
+		while ((dir = readdir(d)) && nr < IR_MAX_EMITTERS) {
+			if (strncmp(dir->d_name, "lirc", 4))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", LIRC_DEV_PATH, dir->d_name);
+			fd = open(path, O_RDWR | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+			if (ioctl(fd, LIRC_GET_FEATURES, &features) < 0)
+				features = 0;
+			close(fd);
+			if (!(features & LIRC_CAN_SEND_PULSE))
+				continue;
+			found[nr] = strdup(path);
+			if (found[nr])
+				nr++;
+		}
+		closedir(d);
+	}
+
+	qsort(found, nr, sizeof(char *), compare_path);
+	for (i = 0 ; i < nr ; i++) {
+		ir_add_emitter(found[i]);
+		free(found[i]);
+	}
+
+	/* keep the previous behavior if the device is not there yet */
+	if (nr_emitters == 0)
+		ir_add_emitter(IRLED_CONTROL_PATH);
+}
+
+static void ir_release_emitters(void)
+{
+	int i;
+
+	for (i = 0 ; i < nr_emitters ; i++)
+		ir_stop_worker(&emitters[i]);
+
+	for (i = 0 ; i < nr_emitters ; i++) {
+		ir_device_close(&emitters[i]);
+		ir_release_pattern(&emitters[i]);
+		pthread_mutex_destroy(&emitters[i].lock);
+		pthread_mutex_destroy(&emitters[i].queue.lock);
+		pthread_cond_destroy(&emitters[i].queue.cond);
+	}
+	free(emitters);
+	emitters = NULL;
+	nr_emitters = 0;
+}
+
+/* Protocol encoders */
+#define IR_MAX_REPEAT		16
+#define IR_MAX_FRAME		80 /* durations of the longest frame */
+#define IR_CODE_CACHE_SIZE	16
+
+struct ir_protocol_info {
+	unsigned int carrier;
+	int unit;         /* us */
+	int header_pulse; /* in units */
+	int header_space;
+	int period;       /* us between the start of two frames */
+	unsigned int max_address;
+	unsigned int max_command;
+};
+
+static const struct ir_protocol_info protocols[] = {
+	[IR_PROTOCOL_NEC] = { 38000, 562, 16, 8, 108000, 0xFFFF, 0xFF },
+	[IR_PROTOCOL_RC5] = { 36000, 889,  0, 0, 113778, 0x1F,   0x7F },
+	[IR_PROTOCOL_RC6] = { 36000, 444,  6, 2, 107000, 0xFF,   0xFF },
+};
+
+struct ir_code {
+	enum ir_protocol protocol;
+	unsigned int address;
+	unsigned int command;
+	int repeat;
+	int toggle;
+	int *pattern;  /* carrier followed by pulses and spaces */
+	int size;
+	int refcnt;    /* one for the cache, one per transmission using it */
+};
+
+/*
+ * The cache and the toggle bit are shared by the callers of all the
+ * emitters, code_lock protects them and the refcount of the codes.
+ */
+static pthread_mutex_t code_lock = PTHREAD_MUTEX_INITIALIZER;
+static GList *code_cache;     /* most recently used first */
+static int code_cache_nr;
+static int toggle;
+
+struct ir_builder {
+	int *buf;
+	int nr;
+	int level;     /* 1 for pulse, 0 for space */
+	int duration;  /* of the current frame */
+};
+
+static void ir_emit(struct ir_builder *b, int level, int us)
+{
+	b->duration += us;
+
+	/* a pattern starts with a pulse */
+	if (b->nr == 1 && level == 0)
+		return;
+
+	if (b->nr > 1 && b->level == level) {
+		b->buf[b->nr - 1] += us;
+		return;
+	}
+
+	b->buf[b->nr++] = us;
+	b->level = level;
+}
+
+/* Manchester coded bit, 'first' is the level of the first half */
+static void ir_emit_biphase(struct ir_builder *b, int first, int us)
+{
+	ir_emit(b, first, us);
+	ir_emit(b, !first, us);
+}
+
+static void ir_encode_nec(struct ir_builder *b, const struct ir_protocol_info *p,
+		unsigned int address, unsigned int command, bool repeat)
+{
+	uint32_t data;
+	int i;
+
+	if (repeat) {
+		ir_emit(b, 1, p->header_pulse * p->unit);
+		ir_emit(b, 0, p->header_space * p->unit / 2);
+		ir_emit(b, 1, p->unit);
+		return;
+	}
+
+	if (address > 0xFF)
+		data = address & 0xFFFF;
+	else
+		data = address | ((~address & 0xFF) << 8);
+	data |= (command << 16) | ((~command & 0xFF) << 24);
+
+	ir_emit(b, 1, p->header_pulse * p->unit);
+	ir_emit(b, 0, p->header_space * p->unit);
+	for (i = 0 ; i < 32 ; i++) {
+		ir_emit(b, 1, p->unit);
+		ir_emit(b, 0, ((data >> i) & 1) ? 3 * p->unit : p->unit);
+	}
+	ir_emit(b, 1, p->unit);
+}
+
+static void ir_encode_rc5(struct ir_builder *b, const struct ir_protocol_info *p,
+		unsigned int address, unsigned int command, int t)
+{
+	uint32_t data;
+	int i;
+
+	/* S1, S2 (inverted command bit 6), toggle, address, command */
+	data = (1 << 13) | ((~command & 0x40) << 6) | (t << 11) |
+		(address << 6) | (command & 0x3F);
+
+	/* RC5 sends a 1 as space then pulse */
+	for (i = 13 ; i >= 0 ; i--)
+		ir_emit_biphase(b, !((data >> i) & 1), p->unit);
+}
+
+static void ir_encode_rc6(struct ir_builder *b, const struct ir_protocol_info *p,
+		unsigned int address, unsigned int command, int t)
+{
+	uint32_t data;
+	int i;
+
+	ir_emit(b, 1, p->header_pulse * p->unit);
+	ir_emit(b, 0, p->header_space * p->unit);
+
+	/* start bit and mode 0 */
+	ir_emit_biphase(b, 1, p->unit);
+	for (i = 0 ; i < 3 ; i++)
+		ir_emit_biphase(b, 0, p->unit);
+
+	/* the toggle bit is twice as long */
+	ir_emit_biphase(b, t, 2 * p->unit);
+
+	/* RC6 sends a 1 as pulse then space */
+	data = (address << 8) | command;
+	for (i = 15 ; i >= 0 ; i--)
+		ir_emit_biphase(b, (data >> i) & 1, p->unit);
+}
+
+static int ir_encode_code(struct ir_code *code)
+{
+	const struct ir_protocol_info *p = &protocols[code->protocol];
+	struct ir_builder b;
+	int i;
+
+	b.buf = malloc(sizeof(int) * (1 + IR_MAX_FRAME * (code->repeat + 1)));
+	if (!b.buf)
+		return -ENOMEM;
+	b.buf[0] = p->carrier;
+	b.nr = 1;
+	b.level = 0;
+
+	for (i = 0 ; i <= code->repeat ; i++) {
+		b.duration = 0;
+		switch (code->protocol) {
+		case IR_PROTOCOL_NEC:
+			ir_encode_nec(&b, p, code->address, code->command, i > 0);
+			break;
+		case IR_PROTOCOL_RC5:
+			ir_encode_rc5(&b, p, code->address, code->command, code->toggle);
+			break;
+		case IR_PROTOCOL_RC6:
+			ir_encode_rc6(&b, p, code->address, code->command, code->toggle);
+			break;
+		}
+		if (i < code->repeat)
+			ir_emit(&b, 0, MAX(p->period - b.duration, p->unit));
+	}
+
+	/* a pattern ends with a pulse */
+	if (b.level == 0)
+		b.nr--;
+
+	code->pattern = b.buf;
+	code->size = b.nr;
+	return 0;
+}
+
+/* code_lock must be held */
+static void ir_code_unref(gpointer data)
+{
+	struct ir_code *code = data;
+
+	if (--code->refcnt > 0)
+		return;
+	free(code->pattern);
+	free(code);
+}
+
+static void ir_put_code(struct ir_code *code)
+{
+	pthread_mutex_lock(&code_lock);
+	ir_code_unref(code);
+	pthread_mutex_unlock(&code_lock);
+}
+
+/* the code returned is held until ir_put_code(), even if evicted meanwhile */
+static struct ir_code *ir_get_code(enum ir_protocol protocol,
+		unsigned int address, unsigned int command, int repeat)
+{
+	const struct ir_protocol_info *p;
+	struct ir_code *code;
+	GList *elem, *last;
+	int t = 0;
+
+	if (protocol < 0 || protocol >= ARRAY_SIZE(protocols))
+		return NULL;
+
+	p = &protocols[protocol];
+	if (address > p->max_address || command > p->max_command ||
+	    repeat < 0 || repeat > IR_MAX_REPEAT)
+		return NULL;
+
+	pthread_mutex_lock(&code_lock);
+
+	/* each key press flips the toggle bit of RC5 and RC6 */
+	if (protocol != IR_PROTOCOL_NEC)
+		t = toggle = !toggle;
+
+	for (elem = code_cache ; elem ; elem = g_list_next(elem)) {
+		code = elem->data;
+		if (code->protocol == protocol && code->address == address &&
+		    code->command == command && code->repeat == repeat &&
+		    code->toggle == t) {
+			code_cache = g_list_remove_link(code_cache, elem);
+			code_cache = g_list_concat(elem, code_cache);
+			goto out;
+		}
+	}
+
+	code = calloc(1, sizeof(struct ir_code));
+	if (!code)
+		goto out;
+	code->protocol = protocol;
+	code->address = address;
+	code->command = command;
+	code->repeat = repeat;
+	code->toggle = t;
+	code->refcnt = 1;
+	if (ir_encode_code(code) < 0) {
+		free(code);
+		code = NULL;
+		goto out;
+	}
+
+	if (code_cache_nr == IR_CODE_CACHE_SIZE) {
+		last = g_list_last(code_cache);
+		ir_code_unref(last->data);
+		code_cache = g_list_delete_link(code_cache, last);
+		code_cache_nr--;
+	}
+	code_cache = g_list_prepend(code_cache, code);
+	code_cache_nr++;
+out:
+	if (code)
+		code->refcnt++;
+	pthread_mutex_unlock(&code_lock);
+	return code;
+}
+
+static void ir_release_codes(void)
+{
+	pthread_mutex_lock(&code_lock);
+	g_list_free_full(code_cache, ir_code_unref);
+	code_cache = NULL;
+	code_cache_nr = 0;
+	pthread_mutex_unlock(&code_lock);
+}
+
+static int ir_transmit_code(enum ir_protocol protocol, unsigned int address,
+		unsigned int command, int repeat)
+{
+	struct ir_code *code;
+	int r;
+
+	TRACE_OP("ir_transmit_code");
+
+	code = ir_get_code(protocol, address, command, repeat);
+	if (!code)
+		return TRACE_RET(-EINVAL);
+
+	r = ir_transmit_impl(code->pattern, code->size);
+	ir_put_code(code);
+	return TRACE_RET(r);
+}
+
+static int ir_transmit_code_async(enum ir_protocol protocol, unsigned int address,
+		unsigned int command, int repeat,
+		IrTransmitDone done_cb, void *data, int *id)
+{
+	struct ir_code *code;
+	int r;
+
+	TRACE_OP("ir_transmit_code_async");
+
+	code = ir_get_code(protocol, address, command, repeat);
+	if (!code)
+		return TRACE_RET(-EINVAL);
+
+	/* the request gets its own copy of the pattern */
+	r = ir_transmit_to_async_impl(1, code->pattern, code->size, done_cb, data, id);
+	ir_put_code(code);
+	return TRACE_RET(r);
+}
+
 static int ir_open(struct hw_info *info,
 		const char *id, struct hw_common **common)
 {
+	struct ir_device_ext *ir_ext;
 	struct ir_device *ir_dev;
 
 	if (!info || !common)
 		return -EINVAL;
 
-	ir_dev = calloc(1, sizeof(struct ir_device));
-	if (!ir_dev)
+	ir_ext = calloc(1, sizeof(struct ir_device_ext));
+	if (!ir_ext)
 		return -ENOMEM;
+	ir_dev = &ir_ext->dev;
+
+	if (ir_refcnt++ == 0)
+		ir_scan_emitters();
 
 	ir_dev->common.info = info;
 	ir_dev->is_available = ir_is_available;
 	ir_dev->transmit = ir_transmit;
+	ir_ext->transmit_async = ir_transmit_async;
+	ir_ext->cancel = ir_cancel;
+	ir_ext->get_emitter_count = ir_get_emitter_count;
+	ir_ext->transmit_to = ir_transmit_to;
+	ir_ext->transmit_to_async = ir_transmit_to_async;
+	ir_ext->transmit_code = ir_transmit_code;
+	ir_ext->transmit_code_async = ir_transmit_code_async;
 
 	*common = (struct hw_common *)ir_dev;
 
@@ -144,8 +1185,13 @@ static int ir_close(struct hw_common *common)
 		return -EINVAL;
 
 	free(common);
-	if (fd >= 0)
-		close(fd);
+	if (--ir_refcnt > 0)
+		return 0;
+
+	/* the workers complete what is left, then the completions are dropped */
+	ir_release_emitters();
+	ir_release_completions();
+	ir_release_codes();
 
 	return 0;
 }
@@ -0,0 +1,77 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __IR_EXT_H__
+#define __IR_EXT_H__
+
+#include <hw/ir.h>
+
+enum ir_protocol {
+	IR_PROTOCOL_NEC,  /* 8 or 16 bits address, 8 bits command */
+	IR_PROTOCOL_RC5,  /* 5 bits address, 7 bits command (RC5X) */
+	IR_PROTOCOL_RC6,  /* mode 0, 8 bits address, 8 bits command */
+};
+
+/* Called from the main loop (result is 0, -ECANCELED or -errno) */
+typedef void (*IrTransmitDone)(int id, int result, void *data);
+
+/*
+ * Pico specific ir device.
+ * ir_open() always returns this structure, so callers which know
+ * about the extension can cast the returned hw_common to it.
+ */
+struct ir_device_ext {
+	struct ir_device dev;
+
+	/*
+	 * Queue a pattern (same layout as transmit) for a worker thread.
+	 * A pattern identical to a queued one with the same callback is
+	 * merged into it: it is sent once more and 'id' is shared.
+	 */
+	int (*transmit_async)(int *frequency_pattern, int size,
+			IrTransmitDone done_cb, void *data, int *id);
+	/* Drop a queued pattern, -EBUSY if it is being sent */
+	int (*cancel)(int id);
+
+	/*
+	 * Emitters are the send capable LIRC devices, in node order.
+	 * transmit, transmit_async and the code functions use emitter 0.
+	 * 'mask' selects emitters by bit, each emitter has its own worker
+	 * so a pattern sent to several of them goes out concurrently.
+	 */
+	int (*get_emitter_count)(int *count);
+	/* Returns once every selected emitter has sent the pattern */
+	int (*transmit_to)(unsigned int mask, int *frequency_pattern, int size);
+	/* done_cb is called once per selected emitter, all share 'id' */
+	int (*transmit_to_async)(unsigned int mask, int *frequency_pattern, int size,
+			IrTransmitDone done_cb, void *data, int *id);
+
+	/*
+	 * Encode a key press in the HAL and send it, followed by 'repeat'
+	 * repeat frames. Encoded frames are cached, so repeated key presses
+	 * are written to the device directly.
+	 */
+	int (*transmit_code)(enum ir_protocol protocol, unsigned int address,
+			unsigned int command, int repeat);
+	int (*transmit_code_async)(enum ir_protocol protocol, unsigned int address,
+			unsigned int command, int repeat,
+			IrTransmitDone done_cb, void *data, int *id);
+};
+
+#endif /* __IR_EXT_H__ */
@@ -19,27 +19,48 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include <linux/limits.h>
 #include <glib.h>
 
 #include <hw/led.h>
 #include <hw/shared.h>
+#include "led_ext.h"
 
-#ifndef CAMERA_BACK_PATH
-#define CAMERA_BACK_PATH	"/sys/class/leds/ktd2692-flash"
+#define TRACE_MODULE "led"
+#include "../trace.h"
+
+#define LEDS_ROOT_PATH          "/sys/class/leds"
+
+#ifndef CAMERA_BACK_NAME
+#define CAMERA_BACK_NAME        "ktd2692-flash"
 #endif
 
-#ifndef TOUCH_KEY_PATH
-#define TOUCH_KEY_PATH          "/sys/class/leds/sec_touchkey"
+#ifndef TOUCH_KEY_NAME
+#define TOUCH_KEY_NAME          "sec_touchkey"
 #endif
 
-#define GET_BRIGHTNESS(val)     (((val) >> 24) & 0xFF)
+#define NOTI_MAX_REQUESTS       16
+#define NOTI_LEGACY_HANDLE      0
 
-/* LED Notification (RGB) */
-#define NOTI_COLOR_TYPE_PATH "/sys/class/leds/led.%d/color"
-#define NOTI_COLOR_BRT_PATH "/sys/class/leds/led.%d/brightness"
+/* below the threaded irqs (50) and the watchdogs (99) */
+#ifndef STROBE_RT_PRIORITY
+#define STROBE_RT_PRIORITY      20
+#endif
+
+#ifndef LED_BLINK_SLACK_MS
+#define LED_BLINK_SLACK_MS      20
+#endif
+
+#define GET_BRIGHTNESS(val)     (((val) >> 24) & 0xFF)
 
 #define GET_TYPE(a)       (((a) >> 24) & 0xFF)
 #define GET_RED_ONLY(a)   ((a) & 0xFF0000)
@@ -55,10 +76,28 @@ typedef enum _led_rgb_type {
 	LED_BLUE,
 } led_rgb_type_e;
 
-struct led_notification_node {
+/* A led found under LEDS_ROOT_PATH */
+struct led_node {
+	char *name;
+	int max;
+	int color;      /* led_rgb_type_e, or -1 if the led has no color */
+	int fd;         /* brightness node, opened by the first write */
+	int scale[256]; /* 8bit brightness -> [0, max] */
+};
+
+/* Registry of all the leds, built once by the first led_open() */
+static struct led_registry {
+	struct led_node *nodes;
+	int nr;
+	int refcnt;
+	struct led_node *camera_back;
+	struct led_node *touch_key;
+} leds;
+
+static struct led_notification_node {
 	char *name;
 	led_rgb_type_e type;
-	char *path;
+	struct led_node *node;
 	int brt;
 } led_noti_nodes[] = {
 	{ "RED",   LED_RED,   NULL, 0 },
@@ -71,117 +110,549 @@ struct notification_play_color_info {
 	int time;
 };
 
-struct notification_play_info {
+static struct notification_play_info {
 	GList *play_list;
 	int nr_play;
 	int index;
-	guint timer;
+	GSource *source;
+	gint64 deadline; /* ideal monotonic time of the current step (us) */
+	gint64 wakeup;   /* deadline aligned on the slack grid */
 } play_info;
 
+struct notification_request {
+	int handle;
+	int priority;
+	struct led_state state;
+};
 
-static int camera_back_set_state(struct led_state *state)
+/* Requests sorted by priority, the first one owns the led */
+static struct notification_queue {
+	GList *list;
+	int nr;
+	int last_handle;
+	int users;               /* opens of the notification led */
+	bool active;             /* the led shows 'current' */
+	struct led_state current;
+} noti_queue;
+
+static struct blink_scheduler {
+	gint64 slack; /* us */
+	gint64 jitter_sum;
+	struct led_blink_stats stats;
+} blink = {
+	.slack = LED_BLINK_SLACK_MS * 1000,
+};
+
+
+static int led_get_color(const char *name)
 {
-	static int max = -1;
-	int brt, r;
+	char path[PATH_MAX];
+	char buf[8];
+	int i, r;
 
-	if (!state) {
-		_E("wrong parameter");
-		return -EINVAL;
-	}
+	snprintf(path, sizeof(path), "%s/%s/color", LEDS_ROOT_PATH, name);
+	r = sys_get_str(path, buf, sizeof(buf));
+	if (r < 0)
+		return -1;
 
-	if (state->type == LED_TYPE_BLINK) {
-		_E("camera back led does not support LED_TYPE_BLINK mode");
-		return -ENOTSUP;
+	for (i = 0 ; i < ARRAY_SIZE(led_noti_nodes) ; i++) {
+		if (!strncmp(buf, led_noti_nodes[i].name, strlen(led_noti_nodes[i].name)))
+			return led_noti_nodes[i].type;
 	}
 
-	/* if there is a max brightness of led */
-	if (max < 0) {
-		r = sys_get_int(CAMERA_BACK_PATH"/max_brightness", &max);
-		if (r < 0) {
-			_E("fail to get max brightness (errno:%d)", r);
-			return r;
-		}
-	}
+	return -1;
+}
 
-	brt = (state->color >> 24) & 0xFF;
-	brt = brt / 255.f * max;
+static int led_node_init(struct led_node *node, const char *name)
+{
+	char path[PATH_MAX];
+	int i, r;
 
-	r = sys_set_int(CAMERA_BACK_PATH"/brightness", brt);
+	snprintf(path, sizeof(path), "%s/%s/max_brightness", LEDS_ROOT_PATH, name);
+	r = sys_get_int(path, &node->max);
 	if (r < 0) {
-		_E("fail to set brightness (errno:%d)", r);
+		_E("fail to get max brightness of %s (errno:%d)", name, r);
 		return r;
 	}
 
+	node->name = strdup(name);
+	if (!node->name)
+		return -ENOMEM;
+	node->fd = -1;
+
+	node->color = led_get_color(name);
+
+	for (i = 0 ; i < ARRAY_SIZE(node->scale) ; i++)
+		node->scale[i] = i * node->max / 255;
+
 	return 0;
 }
 
-static int touch_key_set_state(struct led_state *state)
+static void led_registry_exit(void)
 {
-	static int max = -1;
-	int brt, r;
+	int i;
 
-	if (!state)
-		return -EINVAL;
+	if (--leds.refcnt > 0)
+		return;
 
-	if (state->type == LED_TYPE_BLINK)
-		return -ENOTSUP;
+	for (i = 0 ; i < ARRAY_SIZE(led_noti_nodes) ; i++)
+		led_noti_nodes[i].node = NULL;
 
-	/* if there is a max brightness of led */
-	if (max < 0) {
-		r = sys_get_int(TOUCH_KEY_PATH"/max_brightness", &max);
-		if (r < 0)
-			return r;
+	for (i = 0 ; i < leds.nr ; i++) {
+		if (leds.nodes[i].fd >= 0)
+			close(leds.nodes[i].fd);
+		free(leds.nodes[i].name);
 	}
+	free(leds.nodes);
+	memset(&leds, 0, sizeof(leds));
+}
 
-	brt = GET_BRIGHTNESS(state->color);
-	brt = brt / 255.f * max;
+static int led_registry_init(void)
+{
+	DIR *d;
+	struct dirent *dir;
+	struct led_node *nodes;
+	int i, nr = 0, size = 0;
+
+	if (leds.refcnt++ > 0)
+		return 0;
+
+	/* without leds, the opens succeed and set_state() reports it */
+	d = opendir(LEDS_ROOT_PATH);
+	if (!d) {
+		_E("fail to open %s (errno:%d)", LEDS_ROOT_PATH, errno);
+		return 0;
+	}
 
-	r = sys_set_int(TOUCH_KEY_PATH"/brightness", brt);
-	if (r < 0)
-		return r;
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.')
+			continue;
+
+		if (nr == size) {
+			size = size ? size * 2 : 8;
+			nodes = realloc(leds.nodes, sizeof(*nodes) * size);
+			if (!nodes) {
+				closedir(d);
+				leds.nr = nr;
+				leds.refcnt = 1;
+				led_registry_exit();
+				return -ENOMEM;
+			}
+			leds.nodes = nodes;
+		}
+
+		if (led_node_init(&leds.nodes[nr], dir->d_name) < 0)
+			continue;
+		nr++;
+	}
+	closedir(d);
+	leds.nr = nr;
+
+	for (i = 0 ; i < leds.nr ; i++) {
+		_I("LED %s (max:%d, color:%d)", leds.nodes[i].name,
+				leds.nodes[i].max, leds.nodes[i].color);
+		if (leds.nodes[i].color >= 0)
+			led_noti_nodes[leds.nodes[i].color].node = &leds.nodes[i];
+	}
 
 	return 0;
 }
 
-/* Find sysfs nodes for RGB*/
-static void notification_get_path(int index)
+static struct led_node *led_find(const char *name)
 {
-	char path[PATH_MAX];
-	char buf[8];
-	FILE *fp;
 	int i;
-	size_t len;
 
-	snprintf(path, sizeof(path), NOTI_COLOR_TYPE_PATH, index);
-	fp = fopen(path, "r");
-	if (!fp)
+	for (i = 0 ; i < leds.nr ; i++) {
+		if (!strcmp(leds.nodes[i].name, name))
+			return &leds.nodes[i];
+	}
+
+	return NULL;
+}
+
+/* the brightness node of a led is only opened once the led is used */
+static int led_node_fd(struct led_node *node)
+{
+	char path[PATH_MAX];
+	int fd, unset = -1;
+
+	fd = __atomic_load_n(&node->fd, __ATOMIC_ACQUIRE);
+	if (fd >= 0)
+		return fd;
+
+	snprintf(path, sizeof(path), "%s/%s/brightness", LEDS_ROOT_PATH, node->name);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		_E("fail to open %s (errno:%d)", path, errno);
+		return -errno;
+	}
+
+	/* another thread may have opened it meanwhile */
+	if (!__atomic_compare_exchange_n(&node->fd, &unset, fd, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		fd = unset;
+	}
+
+	return fd;
+}
+
+static ssize_t led_pwrite(struct led_node *node, const char *buf, int len)
+{
+	ssize_t n;
+	int fd;
+
+	TRACE_BEGIN(t);
+	fd = led_node_fd(node);
+	if (fd < 0) {
+		TRACE_SYSFS_WRITE(node->name, t, fd);
+		errno = -fd;
+		return -1;
+	}
+	n = pwrite(fd, buf, len, 0);
+	TRACE_SYSFS_WRITE(node->name, t, n);
+	return n;
+}
+
+static int led_write(struct led_node *node, int brt)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%d", brt);
+	if (led_pwrite(node, buf, len) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Camera flash strobe, driven by a dedicated realtime thread */
+struct strobe_step {
+	char on[16];  /* preformatted brightness */
+	int on_len;
+	long long on_ns;
+	long long off_ns;
+};
+
+static struct strobe_info {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int users;    /* opens of the camera back led */
+	bool started;
+	bool busy;
+	bool exit;
+	volatile bool cancel;
+	struct strobe_step *steps;
+	int nr;
+	LedStrobeDone done_cb;
+	void *data;
+} strobe = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void timespec_add_ns(struct timespec *ts, long long ns)
+{
+	ts->tv_sec += ns / 1000000000LL;
+	ts->tv_nsec += ns % 1000000000LL;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_nsec -= 1000000000L;
+		ts->tv_sec++;
+	}
+}
+
+/* sleep until 'deadline' and return how late the wakeup was (us) */
+static int strobe_wait(const struct timespec *deadline)
+{
+	struct timespec now;
+	long long err;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	err = (now.tv_sec - deadline->tv_sec) * 1000000LL +
+		(now.tv_nsec - deadline->tv_nsec) / 1000;
+	return (err < 0) ? 0 : (int)err;
+}
+
+static void strobe_play(struct strobe_step *steps, int nr,
+		struct led_strobe_report *report)
+{
+	struct timespec deadline;
+	long long err_sum = 0;
+	struct led_node *node = leds.camera_back;
+	int i, err;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	for (i = 0 ; i < nr && !strobe.cancel ; i++) {
+		err = strobe_wait(&deadline);
+		if (led_pwrite(node, steps[i].on, steps[i].on_len) < 0)
+			report->errors++;
+		err_sum += err;
+		if (err > report->max_error_us)
+			report->max_error_us = err;
+
+		timespec_add_ns(&deadline, steps[i].on_ns);
+		err = strobe_wait(&deadline);
+		if (led_pwrite(node, "0", 1) < 0)
+			report->errors++;
+		err_sum += err;
+		if (err > report->max_error_us)
+			report->max_error_us = err;
+
+		timespec_add_ns(&deadline, steps[i].off_ns);
+		report->pulses++;
+	}
+
+	if (report->pulses > 0)
+		report->avg_error_us = (int)(err_sum / (report->pulses * 2));
+	report->cancelled = (report->pulses < nr);
+}
+
+static void *strobe_thread(void *arg)
+{
+	struct led_strobe_report report;
+	struct strobe_step *steps;
+	LedStrobeDone done_cb;
+	void *data;
+	int nr;
+
+	pthread_mutex_lock(&strobe.lock);
+	while (!strobe.exit) {
+		if (!strobe.steps) {
+			pthread_cond_wait(&strobe.cond, &strobe.lock);
+			continue;
+		}
+
+		steps = strobe.steps;
+		nr = strobe.nr;
+		done_cb = strobe.done_cb;
+		data = strobe.data;
+		strobe.steps = NULL;
+		pthread_mutex_unlock(&strobe.lock);
+
+		memset(&report, 0, sizeof(report));
+		strobe_play(steps, nr, &report);
+		free(steps);
+
+		pthread_mutex_lock(&strobe.lock);
+		strobe.busy = false;
+		pthread_cond_broadcast(&strobe.cond);
+		pthread_mutex_unlock(&strobe.lock);
+
+		/* the callback is free to start another sequence */
+		if (done_cb)
+			done_cb(&report, data);
+
+		pthread_mutex_lock(&strobe.lock);
+	}
+	pthread_mutex_unlock(&strobe.lock);
+
+	return NULL;
+}
+
+/* called with strobe.lock held */
+static int strobe_thread_start(void)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int r;
+
+	if (strobe.started)
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = STROBE_RT_PRIORITY;
+	pthread_attr_setschedparam(&attr, &param);
+
+	r = pthread_create(&strobe.thread, &attr, strobe_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (r == EPERM) {
+		_I("No permission for realtime strobe thread, use default policy");
+		r = pthread_create(&strobe.thread, NULL, strobe_thread, NULL);
+	}
+	if (r != 0) {
+		_E("fail to create strobe thread (errno:%d)", r);
+		return -r;
+	}
+
+	strobe.started = true;
+	return 0;
+}
+
+static void strobe_thread_stop(void)
+{
+	pthread_mutex_lock(&strobe.lock);
+	if (!strobe.started) {
+		pthread_mutex_unlock(&strobe.lock);
 		return;
-	len = fread(buf, 1, sizeof(buf) - 1, fp);
-	fclose(fp);
-	if (len == 0) {
-		_E("Failed to get contents");
+	}
+	strobe.exit = true;
+	strobe.cancel = true;
+	pthread_cond_broadcast(&strobe.cond);
+	pthread_mutex_unlock(&strobe.lock);
+
+	pthread_join(strobe.thread, NULL);
+
+	pthread_mutex_lock(&strobe.lock);
+	free(strobe.steps);
+	strobe.steps = NULL;
+	strobe.busy = false;
+	strobe.exit = false;
+	strobe.started = false;
+	pthread_mutex_unlock(&strobe.lock);
+}
+
+/* the strobe is shared by the camera back handles, stop it with the last one */
+static void camera_back_exit(void)
+{
+	if (--strobe.users > 0)
 		return;
+
+	strobe_thread_stop();
+}
+
+static int camera_back_strobe(const struct led_pulse *pulses, int nr,
+		LedStrobeDone done_cb, void *data)
+{
+	struct strobe_step *steps;
+	int i, brt, r;
+
+	TRACE_OP("camera_back_strobe");
+
+	if (!pulses || nr <= 0)
+		return TRACE_RET(-EINVAL);
+
+	if (!leds.camera_back) {
+		_E("camera back led is not found");
+		return TRACE_RET(-ENOENT);
 	}
-	buf[len] = '\0';
 
-	for (i = 0 ; i < ARRAY_SIZE(led_noti_nodes) ; i++) {
-		if (strncmp(buf, led_noti_nodes[i].name, strlen(led_noti_nodes[i].name)))
-			continue;
-		snprintf(path, sizeof(path), NOTI_COLOR_BRT_PATH, index);
-		led_noti_nodes[i].path = strdup(path);
+	/* open the node here, not in the strobe thread */
+	r = led_node_fd(leds.camera_back);
+	if (r < 0)
+		return TRACE_RET(r);
+
+	steps = calloc(nr, sizeof(struct strobe_step));
+	if (!steps)
+		return TRACE_RET(-ENOMEM);
+
+	/* format everything here, the strobe thread only writes */
+	for (i = 0 ; i < nr ; i++) {
+		if (pulses[i].on_us <= 0 || pulses[i].off_us < 0) {
+			free(steps);
+			return TRACE_RET(-EINVAL);
+		}
+		brt = leds.camera_back->scale[pulses[i].brightness & 0xFF];
+		steps[i].on_len = snprintf(steps[i].on, sizeof(steps[i].on), "%d", brt);
+		steps[i].on_ns = pulses[i].on_us * 1000LL;
+		steps[i].off_ns = pulses[i].off_us * 1000LL;
+	}
+
+	pthread_mutex_lock(&strobe.lock);
+	r = strobe_thread_start();
+	if (r < 0)
+		goto out;
+	if (strobe.busy) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	strobe.steps = steps;
+	strobe.nr = nr;
+	strobe.done_cb = done_cb;
+	strobe.data = data;
+	strobe.cancel = false;
+	strobe.busy = true;
+	steps = NULL;
+	pthread_cond_broadcast(&strobe.cond);
+out:
+	pthread_mutex_unlock(&strobe.lock);
+	free(steps);
+	return TRACE_RET(r);
+}
+
+/* cancel the running strobe and wait for the led to be turned off */
+static int camera_back_strobe_stop_impl(void)
+{
+	pthread_mutex_lock(&strobe.lock);
+	strobe.cancel = true;
+	while (strobe.busy && strobe.started)
+		pthread_cond_wait(&strobe.cond, &strobe.lock);
+	pthread_mutex_unlock(&strobe.lock);
+
+	return 0;
+}
+
+static int camera_back_strobe_stop(void)
+{
+	TRACE_OP("camera_back_strobe_stop");
+
+	return TRACE_RET(camera_back_strobe_stop_impl());
+}
+
+static int camera_back_set_state(struct led_state *state)
+{
+	int r;
+
+	TRACE_OP("camera_back_set_state");
+
+	if (!state) {
+		_E("wrong parameter");
+		return TRACE_RET(-EINVAL);
 	}
+
+	if (state->type == LED_TYPE_BLINK) {
+		_E("camera back led does not support LED_TYPE_BLINK mode");
+		return TRACE_RET(-ENOTSUP);
+	}
+
+	if (!leds.camera_back) {
+		_E("camera back led is not found");
+		return TRACE_RET(-ENOENT);
+	}
+
+	camera_back_strobe_stop_impl();
+
+	r = led_write(leds.camera_back, leds.camera_back->scale[GET_BRIGHTNESS(state->color)]);
+	if (r < 0) {
+		_E("fail to set brightness (errno:%d)", r);
+		return TRACE_RET(r);
+	}
+
+	return 0;
+}
+
+static int touch_key_set_state(struct led_state *state)
+{
+	TRACE_OP("touch_key_set_state");
+
+	if (!state)
+		return TRACE_RET(-EINVAL);
+
+	if (state->type == LED_TYPE_BLINK)
+		return TRACE_RET(-ENOTSUP);
+
+	if (!leds.touch_key) {
+		_E("touch key led is not found");
+		return TRACE_RET(-ENOENT);
+	}
+
+	return TRACE_RET(led_write(leds.touch_key, leds.touch_key->scale[GET_BRIGHTNESS(state->color)]));
 }
 
 static int notification_init_led(void)
 {
 	int i;
 
-	notification_get_path(1);
-	notification_get_path(2);
-	notification_get_path(3);
-
 	for (i = 0 ; i < ARRAY_SIZE(led_noti_nodes) ; i++)
-		_I("NOTI LED %s (%s)", led_noti_nodes[i].name, led_noti_nodes[i].path);
+		_I("NOTI LED %s (%s)", led_noti_nodes[i].name,
+				led_noti_nodes[i].node ? led_noti_nodes[i].node->name : "none");
 
 	return 0;
 }
@@ -205,7 +676,7 @@ static int notification_set_brightness(struct led_state *state)
 
 	err = 0;
 	for (i = 0 ; i < ARRAY_SIZE(led_noti_nodes) ; i++) {
-		if (!led_noti_nodes[i].path)
+		if (!led_noti_nodes[i].node)
 			continue;
 		if (led_noti_nodes[i].type == LED_RED)
 			brt = red;
@@ -216,7 +687,7 @@ static int notification_set_brightness(struct led_state *state)
 		else
 			continue;
 
-		ret = sys_set_int(led_noti_nodes[i].path, brt);
+		ret = led_write(led_noti_nodes[i].node, brt);
 		if (ret < 0) {
 			_E("Failed to change brt of led (%s) to (%d)(ret:%d)", led_noti_nodes[i].name, brt, ret);
 			err = ret;
@@ -240,7 +711,7 @@ static void free_func(gpointer data)
 	free(color);
 }
 
-static void release_play_info(void)
+static void stop_play_info(void)
 {
 	if (play_info.play_list) {
 		g_list_free_full(play_info.play_list, free_func);
@@ -248,36 +719,63 @@ static void release_play_info(void)
 	}
 	play_info.nr_play = 0;
 	play_info.index = 0;
-	if (play_info.timer) {
-		g_source_remove(play_info.timer);
-		play_info.timer = 0;
+	if (play_info.source) {
+		g_source_destroy(play_info.source);
+		g_source_unref(play_info.source);
+		play_info.source = NULL;
 	}
+}
 
+static void release_play_info(void)
+{
+	stop_play_info();
+	noti_queue.active = false;
 	notification_turn_off(NULL);
 }
 
-/* timer callback to change colors which are stored in play_list */
-static gboolean notification_timer_expired(gpointer data)
+/*
+ * Wake up on a grid of slack-sized slots instead of the exact deadline,
+ * so that the blink timer can be coalesced with other timers of the process.
+ */
+static gint64 blink_align(gint64 deadline)
+{
+	if (blink.slack <= 0)
+		return deadline;
+
+	return ((deadline + blink.slack - 1) / blink.slack) * blink.slack;
+}
+
+static void blink_update_stats(gint64 now)
+{
+	int jitter, slack;
+
+	jitter = (int)(now - play_info.wakeup);
+	if (jitter < 0)
+		jitter = 0;
+	slack = (int)(play_info.wakeup - play_info.deadline);
+
+	blink.stats.ticks++;
+	blink.stats.last_slack_us = slack;
+	if (slack > blink.stats.max_slack_us)
+		blink.stats.max_slack_us = slack;
+	blink.stats.last_jitter_us = jitter;
+	if (jitter > blink.stats.max_jitter_us)
+		blink.stats.max_jitter_us = jitter;
+	blink.jitter_sum += jitter;
+	blink.stats.avg_jitter_us = (int)(blink.jitter_sum / blink.stats.ticks);
+}
+
+/* play the current item of play_list and arm the source for the next one */
+static int notification_play_step(gint64 now)
 {
 	struct notification_play_color_info *color;
 	struct led_state state = { 0, };
 	int ret;
 
-	if (play_info.timer) {
-		g_source_remove(play_info.timer);
-		play_info.timer = 0;
-	}
-
 	color = g_list_nth_data(play_info.play_list, play_info.index);
 	if (!color) {
 		_E("Failed to get (%d)th item from the play list", play_info.index);
-		goto out;
-	}
-
-	play_info.timer = g_timeout_add(color->time, notification_timer_expired, data);
-	if (play_info.timer == 0) {
-		_E("Failed to add timeout for LED blinking");
-		goto out;
+		return -ENOENT;
 	}
 
 	state.color = color->color;
@@ -285,19 +783,105 @@ static gboolean notification_timer_expired(gpointer data)
 	ret = notification_set_brightness(&state);
 	if (ret < 0) {
 		_E("Failed to set brightness (%d)", ret);
-		goto out;
+		return ret;
 	}
 
+	/* Deadlines are derived from the previous ideal deadline,
+	 * not from the wakeup time, so the pattern does not drift */
+	play_info.deadline += (gint64)color->time * 1000;
+	if (play_info.deadline < now) {
+		_E("Blink pattern is late (%lld us), resync",
+				(long long)(now - play_info.deadline));
+		play_info.deadline = now;
+	}
+	play_info.wakeup = blink_align(play_info.deadline);
+	g_source_set_ready_time(play_info.source, play_info.wakeup);
+
 	play_info.index++;
 	if (play_info.index == play_info.nr_play)
 		play_info.index = 0;
 
+	return 0;
+}
+
+/* timer callback to change colors which are stored in play_list */
+static gboolean notification_timer_expired(gpointer data)
+{
+	gint64 now;
+
+	now = g_get_monotonic_time();
+	blink_update_stats(now);
+
+	if (notification_play_step(now) < 0) {
+		release_play_info();
+		return G_SOURCE_REMOVE;
+	}
+
 	return G_SOURCE_CONTINUE;
+}
 
-out:
-	release_play_info();
+static gboolean blink_source_dispatch(GSource *source,
+		GSourceFunc callback, gpointer data)
+{
+	if (!callback)
+		return G_SOURCE_REMOVE;
+	return callback(data);
+}
 
-	return G_SOURCE_REMOVE;
+static GSourceFuncs blink_source_funcs = {
+	.dispatch = blink_source_dispatch,
+};
+
+/* one source is used for all the steps of the pattern */
+static int notification_play_start(void)
+{
+	gint64 now;
+	int ret;
+
+	play_info.source = g_source_new(&blink_source_funcs, sizeof(GSource));
+	if (!play_info.source) {
+		_E("Failed to create source for LED blinking");
+		return -ENOMEM;
+	}
+	g_source_set_callback(play_info.source,
+			notification_timer_expired, NULL, NULL);
+	if (g_source_attach(play_info.source, NULL) == 0) {
+		_E("Failed to attach source for LED blinking");
+		release_play_info();
+		return -ENOMEM;
+	}
+
+	now = g_get_monotonic_time();
+	play_info.deadline = now;
+	ret = notification_play_step(now);
+	if (ret < 0) {
+		release_play_info();
+		return ret;
+	}
+
+	return 0;
+}
+
+static int notification_set_blink_slack(int slack_ms)
+{
+	TRACE_OP("notification_set_blink_slack");
+
+	if (slack_ms < 0)
+		return TRACE_RET(-EINVAL);
+
+	blink.slack = (gint64)slack_ms * 1000;
+	return 0;
+}
+
+static int notification_get_blink_stats(struct led_blink_stats *stats)
+{
+	TRACE_OP("notification_get_blink_stats");
+
+	if (!stats)
+		return TRACE_RET(-EINVAL);
+
+	*stats = blink.stats;
+	return 0;
 }
 
 /* insert color info to the play_list */
@@ -355,8 +939,7 @@ static int notification_set_brightness_blink(struct led_state *state)
 	play_info.nr_play = g_list_length(play_info.play_list);
 	play_info.index = 0;
 
-	notification_timer_expired(NULL);
-	return 0;
+	return notification_play_start();
 }
 
 /* turn on led notification */
@@ -368,7 +951,68 @@ static int notification_turn_on(struct led_state *state)
 	return notification_set_brightness_blink(state);
 }
 
-static int notification_set_state(struct led_state *state)
+static bool notification_same_state(struct led_state *a, struct led_state *b)
+{
+	if (a->type != b->type || a->color != b->color)
+		return false;
+	if (a->type == LED_TYPE_BLINK &&
+	    (a->duty_on != b->duty_on || a->duty_off != b->duty_off))
+		return false;
+	return true;
+}
+
+/* Show the highest priority request, only if it differs from the led */
+static int notification_update(void)
+{
+	struct notification_request *top;
+	int ret;
+
+	if (!noti_queue.list) {
+		if (!noti_queue.active)
+			return 0;
+		release_play_info();
+		return 0;
+	}
+
+	top = noti_queue.list->data;
+	if (noti_queue.active &&
+	    notification_same_state(&top->state, &noti_queue.current))
+		return 0;
+
+	stop_play_info();
+	noti_queue.current = top->state;
+	noti_queue.active = true;
+
+	ret = notification_turn_on(&top->state);
+	if (ret < 0)
+		noti_queue.active = false;
+
+	return ret;
+}
+
+static gint notification_compare_priority(gconstpointer a, gconstpointer b)
+{
+	const struct notification_request *ra = a;
+	const struct notification_request *rb = b;
+
+	return (ra->priority < rb->priority) - (ra->priority > rb->priority);
+}
+
+static struct notification_request *notification_find_request(int handle)
+{
+	struct notification_request *req;
+	GList *elem;
+
+	for (elem = noti_queue.list ; elem ; elem = g_list_next(elem)) {
+		req = elem->data;
+		if (req->handle == handle)
+			return req;
+	}
+
+	return NULL;
+}
+
+static int notification_check_state(struct led_state *state)
 {
 	if (!state)
 		return -EINVAL;
@@ -382,42 +1026,176 @@ static int notification_set_state(struct led_state *state)
 		return -ENOTSUP;
 	}
 
-	release_play_info();
+	return 0;
+}
+
+static int notification_queue_add(int handle, int priority,
+		struct led_state *state)
+{
+	struct notification_request *req;
+
+	req = notification_find_request(handle);
+	if (req)
+		noti_queue.list = g_list_remove(noti_queue.list, req);
+	else {
+		if (noti_queue.nr >= NOTI_MAX_REQUESTS) {
+			_E("Too many notification requests");
+			return -ENOSPC;
+		}
+		req = calloc(1, sizeof(struct notification_request));
+		if (!req)
+			return -ENOMEM;
+		req->handle = handle;
+		noti_queue.nr++;
+	}
+
+	req->priority = priority;
+	req->state = *state;
+	noti_queue.list = g_list_insert_sorted(noti_queue.list, req,
+			notification_compare_priority);
+
+	return notification_update();
+}
+
+static int notification_queue_remove(int handle)
+{
+	struct notification_request *req;
+
+	req = notification_find_request(handle);
+	if (!req)
+		return -ENOENT;
+
+	noti_queue.list = g_list_remove(noti_queue.list, req);
+	noti_queue.nr--;
+	free(req);
+
+	return notification_update();
+}
+
+static int notification_add_request(struct led_state *state,
+		int priority, int *handle)
+{
+	int ret;
+
+	TRACE_OP("notification_add_request");
+
+	if (!handle)
+		return TRACE_RET(-EINVAL);
+
+	ret = notification_check_state(state);
+	if (ret < 0)
+		return TRACE_RET(ret);
 
 	if (GET_TYPE(state->color) == 0)
-		return notification_turn_off(state);
+		return TRACE_RET(-EINVAL);
 
-	return notification_turn_on(state);
+	do {
+		if (++noti_queue.last_handle <= NOTI_LEGACY_HANDLE)
+			noti_queue.last_handle = NOTI_LEGACY_HANDLE + 1;
+	} while (notification_find_request(noti_queue.last_handle));
+
+	ret = notification_queue_add(noti_queue.last_handle, priority, state);
+	if (ret < 0)
+		return TRACE_RET(ret);
+
+	*handle = noti_queue.last_handle;
+	return 0;
+}
+
+static int notification_remove_request(int handle)
+{
+	TRACE_OP("notification_remove_request");
+
+	if (handle == NOTI_LEGACY_HANDLE)
+		return TRACE_RET(-EINVAL);
+
+	return TRACE_RET(notification_queue_remove(handle));
+}
+
+/* drop the requests and the blink source, before the leds go away */
+static void notification_exit(void)
+{
+	if (--noti_queue.users > 0)
+		return;
+
+	stop_play_info();
+	g_list_free_full(noti_queue.list, free);
+	noti_queue.list = NULL;
+	noti_queue.nr = 0;
+	if (noti_queue.active)
+		notification_turn_off(NULL);
+	noti_queue.active = false;
+}
+
+/* set_state() owns a single request at the default priority */
+static int notification_set_state(struct led_state *state)
+{
+	int ret;
+
+	TRACE_OP("notification_set_state");
+
+	ret = notification_check_state(state);
+	if (ret < 0)
+		return TRACE_RET(ret);
+
+	if (GET_TYPE(state->color) == 0) {
+		ret = notification_queue_remove(NOTI_LEGACY_HANDLE);
+		return TRACE_RET((ret == -ENOENT) ? 0 : ret);
+	}
+
+	return TRACE_RET(notification_queue_add(NOTI_LEGACY_HANDLE,
+			LED_NOTIFICATION_PRIORITY_DEFAULT, state));
 }
 
 static int led_open(struct hw_info *info,
 		const char *id, struct hw_common **common)
 {
+	struct led_device_ext *led_ext;
 	struct led_device *led_dev;
 	size_t len;
+	int r;
 
 	if (!info || !id || !common)
 		return -EINVAL;
 
-	led_dev = calloc(1, sizeof(struct led_device));
-	if (!led_dev)
+	led_ext = calloc(1, sizeof(struct led_device_ext));
+	if (!led_ext)
 		return -ENOMEM;
 
+	r = led_registry_init();
+	if (r < 0) {
+		_E("fail to enumerate leds (errno:%d)", r);
+		free(led_ext);
+		return r;
+	}
+
+	led_dev = &led_ext->dev;
 	led_dev->common.info = info;
 
 	len = strlen(id) + 1;
-	if (!strncmp(id, LED_ID_CAMERA_BACK, len))
+	if (!strncmp(id, LED_ID_CAMERA_BACK, len)) {
+		leds.camera_back = led_find(CAMERA_BACK_NAME);
+		strobe.users++;
 		led_dev->set_state = camera_back_set_state;
+		led_ext->strobe = camera_back_strobe;
+		led_ext->strobe_stop = camera_back_strobe_stop;
 
-	else if (!strncmp(id, LED_ID_TOUCH_KEY, len))
+	} else if (!strncmp(id, LED_ID_TOUCH_KEY, len)) {
+		leds.touch_key = led_find(TOUCH_KEY_NAME);
 		led_dev->set_state = touch_key_set_state;
 
-	else if (!strncmp(id, LED_ID_NOTIFICATION, len)) {
+	} else if (!strncmp(id, LED_ID_NOTIFICATION, len)) {
 		notification_init_led();
+		noti_queue.users++;
 		led_dev->set_state = notification_set_state;
+		led_ext->set_blink_slack = notification_set_blink_slack;
+		led_ext->get_blink_stats = notification_get_blink_stats;
+		led_ext->add_request = notification_add_request;
+		led_ext->remove_request = notification_remove_request;
 
 	} else {
-		free(led_dev);
+		led_registry_exit();
+		free(led_ext);
 		return -ENOTSUP;
 	}
 
@@ -427,10 +1205,19 @@ static int led_open(struct hw_info *info,
 
 static int led_close(struct hw_common *common)
 {
+	struct led_device *led_dev;
+
 	if (!common)
 		return -EINVAL;
 
+	led_dev = (struct led_device *)common;
+	if (led_dev->set_state == camera_back_set_state)
+		camera_back_exit();
+	else if (led_dev->set_state == notification_set_state)
+		notification_exit();
+
 	free(common);
+	led_registry_exit();
 	return 0;
 }
 
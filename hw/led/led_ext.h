@@ -0,0 +1,86 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2015 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __LED_EXT_H__
+#define __LED_EXT_H__
+
+#include <hw/led.h>
+
+/* Priority of the request owned by led_device.set_state() */
+#define LED_NOTIFICATION_PRIORITY_DEFAULT	0
+
+/*
+ * Blink steps wake up late on purpose, by up to the slack, to share the
+ * wakeup with other timers. The jitter is the scheduling error measured
+ * against that planned wakeup, the slack is the planned delay itself.
+ */
+struct led_blink_stats {
+	unsigned int ticks;
+	int last_jitter_us;
+	int max_jitter_us;
+	int avg_jitter_us;
+	int last_slack_us;
+	int max_slack_us;
+};
+
+/* One flash pulse of a strobe sequence */
+struct led_pulse {
+	unsigned int brightness; /* 0 ~ 255 */
+	int on_us;
+	int off_us;
+};
+
+/* Timing achieved by a strobe sequence */
+struct led_strobe_report {
+	int pulses;
+	int errors;
+	int cancelled;
+	int max_error_us;
+	int avg_error_us;
+};
+
+/* Called from the strobe thread when a sequence ends */
+typedef void (*LedStrobeDone)(struct led_strobe_report *report, void *data);
+
+/*
+ * Pico specific led device.
+ * led_open() always returns this structure, so callers which know
+ * about the extension can cast the returned hw_common to it.
+ */
+struct led_device_ext {
+	struct led_device dev;
+
+	/* Timer slack applied to blink deadlines (ms, 0 disables it) */
+	int (*set_blink_slack)(int slack_ms);
+	int (*get_blink_stats)(struct led_blink_stats *stats);
+
+	/*
+	 * Notification requests. The request with the highest priority
+	 * is shown, the others are kept and resumed when it is removed.
+	 */
+	int (*add_request)(struct led_state *state, int priority, int *handle);
+	int (*remove_request)(int handle);
+
+	/* Camera flash pulse sequences, played asynchronously */
+	int (*strobe)(const struct led_pulse *pulses, int nr,
+			LedStrobeDone done_cb, void *data);
+	int (*strobe_stop)(void);
+};
+
+#endif /* __LED_EXT_H__ */
@@ -0,0 +1,37 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Entry of a module of the monolithic build.
+ * hwcommon looks up one hw_info per library, so each module keeps a
+ * small library of its own which exports the hw_info of the module
+ * built into the shared core (HW_CORE_INFO, set by the build).
+ */
+
+#include <string.h>
+#include <hw/common.h>
+
+extern struct hw_info HW_CORE_INFO;
+
+HARDWARE_MODULE_STRUCTURE;
+
+/* run by dlopen, before hwcommon reads the structure */
+static void __attribute__((constructor)) module_stub_init(void)
+{
+	memcpy(&HARDWARE_INFO_SYM, &HW_CORE_INFO, sizeof(struct hw_info));
+}
@@ -0,0 +1,184 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+static struct pico_stats_entry *entries;
+static pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int pico_stats_timing;
+
+void pico_stats_set_timing(bool enable)
+{
+	__atomic_store_n(&pico_stats_timing, enable, __ATOMIC_RELAXED);
+}
+
+void pico_stats_register(struct pico_stats_entry *entry)
+{
+	struct pico_stats_entry **p;
+
+	pthread_mutex_lock(&entries_lock);
+	for (p = &entries ; *p ; p = &(*p)->next)
+		;
+	entry->next = NULL;
+	*p = entry;
+	pthread_mutex_unlock(&entries_lock);
+}
+
+void pico_stats_unregister(struct pico_stats_entry *entry)
+{
+	struct pico_stats_entry **p;
+
+	pthread_mutex_lock(&entries_lock);
+	for (p = &entries ; *p ; p = &(*p)->next) {
+		if (*p == entry) {
+			*p = entry->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&entries_lock);
+}
+
+#define LOAD(field) \
+	(__atomic_load_n(&src->field, __ATOMIC_RELAXED))
+
+static void stats_add(struct pico_stats *dst, const struct pico_stats *src)
+{
+	dst->calls += LOAD(calls);
+	dst->op_errors += LOAD(op_errors);
+	dst->errors += LOAD(errors);
+	dst->sysfs_reads += LOAD(sysfs_reads);
+	dst->sysfs_writes += LOAD(sysfs_writes);
+	dst->dev_reads += LOAD(dev_reads);
+	dst->dev_writes += LOAD(dev_writes);
+	dst->proc_reads += LOAD(proc_reads);
+	dst->bytes_read += LOAD(bytes_read);
+	dst->bytes_written += LOAD(bytes_written);
+	dst->uevents_received += LOAD(uevents_received);
+	dst->uevents_dispatched += LOAD(uevents_dispatched);
+	dst->op_time_ns += LOAD(op_time_ns);
+	dst->sysfs_time_ns += LOAD(sysfs_time_ns);
+	dst->dev_time_ns += LOAD(dev_time_ns);
+	dst->proc_time_ns += LOAD(proc_time_ns);
+}
+
+int pico_stats_get_module_count(int *count)
+{
+	struct pico_stats_entry *e;
+	int n = 0;
+
+	if (!count)
+		return -EINVAL;
+
+	pthread_mutex_lock(&entries_lock);
+	for (e = entries ; e ; e = e->next)
+		n++;
+	pthread_mutex_unlock(&entries_lock);
+
+	*count = n;
+	return 0;
+}
+
+int pico_stats_get_module(int index, const char **module,
+		struct pico_stats *stats)
+{
+	struct pico_stats_entry *e;
+
+	if (!module || !stats || index < 0)
+		return -EINVAL;
+
+	pthread_mutex_lock(&entries_lock);
+	for (e = entries ; e && index > 0 ; e = e->next)
+		index--;
+	if (e) {
+		*module = e->module;
+		memset(stats, 0, sizeof(*stats));
+		stats_add(stats, &e->stats);
+	}
+	pthread_mutex_unlock(&entries_lock);
+
+	return e ? 0 : -ENOENT;
+}
+
+int pico_stats_get(const char *module, struct pico_stats *stats)
+{
+	struct pico_stats_entry *e;
+	int found = 0;
+
+	if (!module || !stats)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&entries_lock);
+	for (e = entries ; e ; e = e->next) {
+		if (strcmp(e->module, module))
+			continue;
+		stats_add(stats, &e->stats);
+		found = 1;
+	}
+	pthread_mutex_unlock(&entries_lock);
+
+	return found ? 0 : -ENOENT;
+}
+
+int pico_stats_dump(char *buf, size_t size)
+{
+	struct pico_stats_entry *e;
+	struct pico_stats s;
+	size_t len = 0;
+	int n;
+
+	if (!buf && size > 0)
+		return -EINVAL;
+
+	if (size > 0)
+		buf[0] = '\0';
+
+	pthread_mutex_lock(&entries_lock);
+	for (e = entries ; e ; e = e->next) {
+		memset(&s, 0, sizeof(s));
+		stats_add(&s, &e->stats);
+		n = snprintf(len < size ? buf + len : NULL,
+				len < size ? size - len : 0,
+				"%s calls=%llu op_errors=%llu errors=%llu "
+				"sysfs_reads=%llu sysfs_writes=%llu "
+				"dev_reads=%llu dev_writes=%llu proc_reads=%llu "
+				"bytes_read=%llu bytes_written=%llu uevents_received=%llu "
+				"uevents_dispatched=%llu op_time_us=%llu sysfs_time_us=%llu "
+				"dev_time_us=%llu proc_time_us=%llu\n",
+				e->module, s.calls, s.op_errors, s.errors,
+				s.sysfs_reads, s.sysfs_writes,
+				s.dev_reads, s.dev_writes, s.proc_reads,
+				s.bytes_read, s.bytes_written, s.uevents_received,
+				s.uevents_dispatched, s.op_time_ns / 1000,
+				s.sysfs_time_ns / 1000, s.dev_time_ns / 1000,
+				s.proc_time_ns / 1000);
+		if (n > 0)
+			len += n;
+	}
+	pthread_mutex_unlock(&entries_lock);
+
+	return len;
+}
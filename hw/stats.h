@@ -0,0 +1,82 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Counters of a module since it was loaded */
+struct pico_stats {
+	unsigned long long calls;           /* module operations */
+	unsigned long long op_errors;       /* operations which returned an error */
+	unsigned long long errors;          /* failed sysfs, device node and procfs accesses */
+	unsigned long long sysfs_reads;
+	unsigned long long sysfs_writes;
+	unsigned long long dev_reads;       /* device nodes */
+	unsigned long long dev_writes;
+	unsigned long long proc_reads;      /* procfs */
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	unsigned long long uevents_received;
+	unsigned long long uevents_dispatched;
+	unsigned long long op_time_ns;      /* cumulative, in the operations */
+	unsigned long long sysfs_time_ns;   /* cumulative, in the sysfs accesses */
+	unsigned long long dev_time_ns;     /* cumulative, in the device node accesses */
+	unsigned long long proc_time_ns;    /* cumulative, in the procfs accesses */
+};
+
+/*
+ * Measuring the durations costs two clock reads per operation and access,
+ * so without ENABLE_TRACE the _time_ns counters stay at 0 until the daemon
+ * enables the timing. With ENABLE_TRACE it is always on.
+ */
+extern int pico_stats_timing;
+void pico_stats_set_timing(bool enable);
+
+/*
+ * One entry per module, registered by trace.h when the module is loaded.
+ * The counters are updated with relaxed atomics from any thread.
+ */
+struct pico_stats_entry {
+	const char *module;
+	struct pico_stats stats;
+	struct pico_stats_entry *next;
+};
+
+void pico_stats_register(struct pico_stats_entry *entry);
+void pico_stats_unregister(struct pico_stats_entry *entry);
+
+/*
+ * Query functions of the core library, for the daemon. The modules are
+ * listed in their loading order, get() sums the entries of a module.
+ */
+int pico_stats_get_module_count(int *count);
+int pico_stats_get_module(int index, const char **module,
+		struct pico_stats *stats);
+int pico_stats_get(const char *module, struct pico_stats *stats);
+
+/*
+ * One "<module> calls=.. op_errors=.. ..." line per module, with the
+ * snprintf semantics: returns the length of the whole dump.
+ */
+int pico_stats_dump(char *buf, size_t size);
+
+#endif /* __STATS_H__ */
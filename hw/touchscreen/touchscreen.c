@@ -19,78 +19,246 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <linux/limits.h>
-#include <dirent.h>
+#include <glib.h>
 
 #include <hw/touchscreen.h>
 #include <hw/shared.h>
+#include "touchscreen_ext.h"
+#include "../udev.h"
+
+#define TRACE_MODULE "touchscreen"
+#include "../trace.h"
 
 #define INPUT_PATH      "/sys/class/input/"
-#define KEY_CAPABILITIES_PATH  "/device/capabilities/key"
 #define ENABLED_PATH           "/device/enabled"
-#define TOUCHSCREEN_CAPABILITY 400
+#define TOUCHSCREEN_PROPERTY   "ID_INPUT_TOUCHSCREEN"
 
 #define TURNON_TOUCHSCREEN     1
 #define TURNOFF_TOUCHSCREEN    0
+#define UNKNOWN_TOUCHSCREEN    -1
 
-static char *touchscreen_node;
+struct touchscreen {
+	char *name; /* input device */
+	char *node; /* its enabled node */
+	int state;  /* last value read or written */
+};
 
-static int touchscreen_probe(void)
+/* A state change handed over to the worker thread */
+struct set_request {
+	char **nodes;
+	int nr;
+	int val;
+	int result;
+	TouchscreenSetDone done_cb;
+	void *data;
+	guint idle;   /* completion source, once the request is done */
+};
+
+static struct async_info {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool started;
+	bool exit;
+	GList *queue;
+	int inflight; /* requests not written yet */
+	GList *done;  /* requests waiting for their completion source */
+} async = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* All the touchscreens, the first one reports the state */
+static GList *touchscreens;
+static int touchscreen_refcnt;
+
+static struct touchscreen *touchscreen_find(const char *name)
+{
+	struct touchscreen *ts;
+	GList *elem;
+
+	for (elem = touchscreens ; elem ; elem = g_list_next(elem)) {
+		ts = elem->data;
+		if (!strcmp(ts->name, name))
+			return ts;
+	}
+
+	return NULL;
+}
+
+static void touchscreen_free(gpointer data)
+{
+	struct touchscreen *ts = data;
+
+	free(ts->name);
+	free(ts->node);
+	free(ts);
+}
+
+static int touchscreen_add(const char *name)
 {
-	DIR *d;
-	struct dirent *dir;
+	struct touchscreen *ts;
 	char buf[PATH_MAX];
-	int val, ret = -ENOTSUP;
 
-	d = opendir(INPUT_PATH);
-	if (!d)
-		return -errno;
+	if (touchscreen_find(name))
+		return 0;
 
-	while ((dir = readdir(d))) {
-		if (dir->d_name[0] == '.')
-			continue;
-		snprintf(buf, sizeof(buf), "%s%s%s", INPUT_PATH,
-				dir->d_name, KEY_CAPABILITIES_PATH);
+	ts = calloc(1, sizeof(struct touchscreen));
+	if (!ts)
+		return -ENOMEM;
 
-		ret = sys_get_int(buf, &val);
-		if (ret < 0 || val != TOUCHSCREEN_CAPABILITY)
-			continue;
+	ts->state = UNKNOWN_TOUCHSCREEN;
 
-		snprintf(buf, sizeof(buf), "%s%s%s", INPUT_PATH,
-				dir->d_name, ENABLED_PATH);
+	snprintf(buf, sizeof(buf), "%s%s%s", INPUT_PATH, name, ENABLED_PATH);
+	ts->node = strndup(buf, strlen(buf));
+	ts->name = strdup(name);
+	if (!ts->node || !ts->name) {
+		_E("strndup() failed");
+		touchscreen_free(ts);
+		return -ENOMEM;
+	}
 
-		touchscreen_node = strndup(buf, strlen(buf));
-		if (touchscreen_node) {
-			_I("touchscreen node (%s)", touchscreen_node);
-			ret = 0;
-		} else {
-			_E("strndup() failed");
-			ret = -ENOMEM;
-		}
-		break;
+	touchscreens = g_list_append(touchscreens, ts);
+	_I("touchscreen node (%s)", ts->node);
+	return 0;
+}
+
+static void touchscreen_remove(const char *name)
+{
+	struct touchscreen *ts;
+
+	ts = touchscreen_find(name);
+	if (!ts)
+		return;
+
+	_I("touchscreen (%s) is removed", name);
+	touchscreens = g_list_remove(touchscreens, ts);
+	touchscreen_free(ts);
+}
+
+static bool is_input_device(const char *syspath)
+{
+	const char *name;
+
+	/* event and mouse nodes of the device have the property as well */
+	name = strrchr(syspath, '/');
+	return name && !strncmp(name + 1, "input", 5);
+}
+
+/*
+ * udev already classified the input devices, ask for the touchscreens.
+ * libudev reads /sys and the udev database of the running system, it has
+ * no root to redirect, so the probe cannot run against a fake sysfs tree.
+ */
+static int touchscreen_probe(void)
+{
+	struct udev *udev;
+	struct udev_enumerate *e;
+	struct udev_list_entry *entry;
+	const char *path;
+	int ret;
+
+	udev = udev_new();
+	if (!udev)
+		return -ENOMEM;
+
+	e = udev_enumerate_new(udev);
+	if (!e) {
+		udev_unref(udev);
+		return -ENOMEM;
+	}
+
+	udev_enumerate_add_match_subsystem(e, "input");
+	udev_enumerate_add_match_property(e, TOUCHSCREEN_PROPERTY, "1");
+	ret = udev_enumerate_scan_devices(e);
+	if (ret < 0) {
+		_E("Failed to scan input devices (%d)", ret);
+		goto out;
+	}
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+		path = udev_list_entry_get_name(entry);
+		if (!path || !is_input_device(path))
+			continue;
+		touchscreen_add(strrchr(path, '/') + 1);
 	}
-	closedir(d);
 
+	ret = touchscreens ? 0 : -ENOTSUP;
+out:
+	udev_enumerate_unref(e);
+	udev_unref(udev);
 	return ret;
 }
 
+/* Follow the touchscreens when they are added or removed, e.g. by a firmware reset */
+static void input_uevent_delivered(struct udev_device *dev)
+{
+	const char *path, *action, *val;
+
+	path = udev_device_get_syspath(dev);
+	action = udev_device_get_action(dev);
+	if (!path || !action || !is_input_device(path))
+		return;
+
+	if (!strcmp(action, "remove")) {
+		touchscreen_remove(strrchr(path, '/') + 1);
+		return;
+	}
+
+	if (strcmp(action, "add"))
+		return;
+
+	val = udev_device_get_property_value(dev, TOUCHSCREEN_PROPERTY);
+	if (!val || strcmp(val, "1"))
+		return;
+
+	touchscreen_add(strrchr(path, '/') + 1);
+}
+
+static struct uevent_handler uh = {
+	.subsystem = "input",
+	.uevent_func = input_uevent_delivered,
+};
+
+/* wait for the worker, so that writes are applied in order */
+static void touchscreen_wait_async(void)
+{
+	pthread_mutex_lock(&async.lock);
+	while (async.inflight > 0)
+		pthread_cond_wait(&async.cond, &async.lock);
+	pthread_mutex_unlock(&async.lock);
+}
+
 static int touchscreen_get_state(enum touchscreen_state *state)
 {
+	struct touchscreen *ts;
 	int ret, val;
 
-	if (!touchscreen_node || !(*touchscreen_node))
-		return -ENOENT;
+	TRACE_OP("touchscreen_get_state");
 
-	if (!state)
-		return -EINVAL;
+	if (!touchscreens)
+		return TRACE_RET(-ENOENT);
 
-	ret = sys_get_int(touchscreen_node, &val);
-	if (ret < 0) {
-		_E("Failed to get touchscreen state (%d)", ret);
-		return ret;
-	}
+	if (!state)
+		return TRACE_RET(-EINVAL);
+
+	ts = touchscreens->data;
+	if (ts->state == UNKNOWN_TOUCHSCREEN) {
+		touchscreen_wait_async();
+		ret = sys_get_int(ts->node, &val);
+		if (ret < 0) {
+			_E("Failed to get touchscreen state (%d)", ret);
+			return TRACE_RET(ret);
+		}
+		if (val == TURNOFF_TOUCHSCREEN || val == TURNON_TOUCHSCREEN)
+			ts->state = val;
+	} else
+		val = ts->state;
 
 	switch (val) {
 	case TURNOFF_TOUCHSCREEN:
@@ -101,56 +269,284 @@ static int touchscreen_get_state(enum touchscreen_state *state)
 		break;
 	default:
 		_E("Failed to get touchscreen state (%d)", val);
-		return -EINVAL;
+		return TRACE_RET(-EINVAL);
 	}
 
 	return 0;
 }
 
-static int touchscreen_set_state(enum touchscreen_state state)
+static int touchscreen_state_to_val(enum touchscreen_state state)
 {
-	int ret, val;
-
-	if (!touchscreen_node || !(*touchscreen_node))
-		return -ENOENT;
-
 	switch (state) {
 	case TOUCHSCREEN_OFF:
-		val = TURNOFF_TOUCHSCREEN;
-		break;
+		return TURNOFF_TOUCHSCREEN;
 	case TOUCHSCREEN_ON:
-		val = TURNON_TOUCHSCREEN;
-		break;
+		return TURNON_TOUCHSCREEN;
 	default:
 		_E("Invalid input (%d)", state);
 		return -EINVAL;
 	}
+}
 
-	ret = sys_set_int(touchscreen_node, val);
-	if (ret < 0)
-		_E("Failed to change touchscreen state (%d)", ret);
+static int touchscreen_set_state(enum touchscreen_state state)
+{
+	struct touchscreen *ts;
+	GList *elem;
+	int ret, val, err = 0;
 
-	return ret;
+	TRACE_OP("touchscreen_set_state");
+
+	if (!touchscreens)
+		return TRACE_RET(-ENOENT);
+
+	val = touchscreen_state_to_val(state);
+	if (val < 0)
+		return TRACE_RET(val);
+
+	touchscreen_wait_async();
+
+	for (elem = touchscreens ; elem ; elem = g_list_next(elem)) {
+		ts = elem->data;
+		if (ts->state == val)
+			continue;
+		ret = sys_set_int(ts->node, val);
+		if (ret < 0) {
+			_E("Failed to change touchscreen (%s) state (%d)", ts->name, ret);
+			ts->state = UNKNOWN_TOUCHSCREEN;
+			err = ret;
+			continue;
+		}
+		ts->state = val;
+	}
+
+	return TRACE_RET(err);
+}
+
+static void set_request_free(struct set_request *req)
+{
+	int i;
+
+	for (i = 0 ; i < req->nr ; i++)
+		free(req->nodes[i]);
+	free(req->nodes);
+	free(req);
+}
+
+/* main loop side of a finished request */
+static gboolean set_request_done(gpointer data)
+{
+	struct set_request *req = data;
+	struct touchscreen *ts;
+	GList *elem;
+	int i;
+
+	pthread_mutex_lock(&async.lock);
+	async.done = g_list_remove(async.done, req);
+	pthread_mutex_unlock(&async.lock);
+
+	if (req->result < 0) {
+		/* the driver state is not known anymore */
+		for (elem = touchscreens ; elem ; elem = g_list_next(elem)) {
+			ts = elem->data;
+			for (i = 0 ; i < req->nr ; i++) {
+				if (!strcmp(ts->node, req->nodes[i]))
+					ts->state = UNKNOWN_TOUCHSCREEN;
+			}
+		}
+	}
+
+	if (req->done_cb)
+		req->done_cb((req->val == TURNON_TOUCHSCREEN) ?
+				TOUCHSCREEN_ON : TOUCHSCREEN_OFF,
+				req->result, req->data);
+
+	set_request_free(req);
+	return G_SOURCE_REMOVE;
+}
+
+/* async.lock must be held */
+static void set_request_complete(struct set_request *req)
+{
+	req->idle = g_idle_add(set_request_done, req);
+	async.done = g_list_prepend(async.done, req);
+}
+
+static void *touchscreen_worker(void *arg)
+{
+	struct set_request *req;
+	int i, ret;
+
+	pthread_mutex_lock(&async.lock);
+	while (!async.exit) {
+		if (!async.queue) {
+			pthread_cond_wait(&async.cond, &async.lock);
+			continue;
+		}
+
+		req = async.queue->data;
+		async.queue = g_list_delete_link(async.queue, async.queue);
+		pthread_mutex_unlock(&async.lock);
+
+		for (i = 0 ; i < req->nr ; i++) {
+			ret = sys_set_int(req->nodes[i], req->val);
+			if (ret < 0) {
+				_E("Failed to change touchscreen state (%d)", ret);
+				req->result = ret;
+			}
+		}
+		pthread_mutex_lock(&async.lock);
+		set_request_complete(req);
+		async.inflight--;
+		pthread_cond_broadcast(&async.cond);
+	}
+	pthread_mutex_unlock(&async.lock);
+
+	return NULL;
+}
+
+static void touchscreen_stop_worker(void)
+{
+	struct set_request *req;
+	GList *elem;
+
+	if (async.started) {
+		pthread_mutex_lock(&async.lock);
+		async.exit = true;
+		pthread_cond_broadcast(&async.cond);
+		pthread_mutex_unlock(&async.lock);
+
+		pthread_join(async.thread, NULL);
+	}
+
+	/* the completions must not run once the touchscreens are gone */
+	for (elem = async.done ; elem ; elem = g_list_next(elem)) {
+		req = elem->data;
+		g_source_remove(req->idle);
+		set_request_free(req);
+	}
+	g_list_free(async.done);
+	async.done = NULL;
+
+	g_list_free_full(async.queue, (GDestroyNotify)set_request_free);
+	async.queue = NULL;
+	async.inflight = 0;
+	async.exit = false;
+	async.started = false;
+}
+
+static int touchscreen_set_state_async(enum touchscreen_state state,
+		TouchscreenSetDone done_cb, void *data)
+{
+	struct set_request *req;
+	struct touchscreen *ts;
+	GList *elem;
+	int val, r;
+
+	TRACE_OP("touchscreen_set_state_async");
+
+	if (!touchscreens)
+		return TRACE_RET(-ENOENT);
+
+	val = touchscreen_state_to_val(state);
+	if (val < 0)
+		return TRACE_RET(val);
+
+	req = calloc(1, sizeof(struct set_request));
+	if (!req)
+		return TRACE_RET(-ENOMEM);
+	req->val = val;
+	req->done_cb = done_cb;
+	req->data = data;
+
+	req->nodes = calloc(g_list_length(touchscreens), sizeof(char *));
+	if (!req->nodes) {
+		free(req);
+		return TRACE_RET(-ENOMEM);
+	}
+
+	/* the cache follows the request, the completion fixes it on failure */
+	for (elem = touchscreens ; elem ; elem = g_list_next(elem)) {
+		ts = elem->data;
+		if (ts->state == val)
+			continue;
+		req->nodes[req->nr] = strdup(ts->node);
+		if (!req->nodes[req->nr]) {
+			set_request_free(req);
+			return TRACE_RET(-ENOMEM);
+		}
+		req->nr++;
+		ts->state = val;
+	}
+
+	if (req->nr == 0) {
+		pthread_mutex_lock(&async.lock);
+		set_request_complete(req);
+		pthread_mutex_unlock(&async.lock);
+		return 0;
+	}
+
+	pthread_mutex_lock(&async.lock);
+	if (!async.started) {
+		r = pthread_create(&async.thread, NULL, touchscreen_worker, NULL);
+		if (r != 0) {
+			pthread_mutex_unlock(&async.lock);
+			_E("Failed to create touchscreen worker (%d)", r);
+			for (elem = touchscreens ; elem ; elem = g_list_next(elem)) {
+				ts = elem->data;
+				ts->state = UNKNOWN_TOUCHSCREEN;
+			}
+			set_request_free(req);
+			return TRACE_RET(-r);
+		}
+		async.started = true;
+	}
+	async.queue = g_list_append(async.queue, req);
+	async.inflight++;
+	pthread_cond_broadcast(&async.cond);
+	pthread_mutex_unlock(&async.lock);
+
+	return 0;
 }
 
 static int touchscreen_open(struct hw_info *info,
 		const char *id, struct hw_common **common)
 {
+	struct touchscreen_device_ext *touchscreen_ext;
 	struct touchscreen_device *touchscreen_dev;
+	int ret;
 
 	if (!info || !common)
 		return -EINVAL;
 
-	if (touchscreen_probe() < 0)
-		return -ENOTSUP;
-
-	touchscreen_dev = calloc(1, sizeof(struct touchscreen_device));
-	if (!touchscreen_dev)
+	touchscreen_ext = calloc(1, sizeof(struct touchscreen_device_ext));
+	if (!touchscreen_ext)
 		return -ENOMEM;
+	touchscreen_dev = &touchscreen_ext->dev;
+
+	/* the worker, the uevent handler and the list are shared by the handles */
+	if (touchscreen_refcnt > 0)
+		goto out;
+
+	/* register first, so that a touchscreen added during the probe is caught */
+	ret = register_udev_event_control(&uh);
+	if (ret == 0)
+		ret = uevent_control_udev_start();
+	if (ret < 0) {
+		_E("Failed to monitor input uevents (%d)", ret);
+		unregister_udev_event_control(&uh);
+		if (touchscreen_probe() < 0) {
+			free(touchscreen_ext);
+			return -ENOTSUP;
+		}
+	} else if (touchscreen_probe() < 0)
+		_I("touchscreen is not found yet");
 
+out:
+	touchscreen_refcnt++;
 	touchscreen_dev->common.info = info;
 	touchscreen_dev->get_state = touchscreen_get_state;
 	touchscreen_dev->set_state = touchscreen_set_state;
+	touchscreen_ext->set_state_async = touchscreen_set_state_async;
 
 	*common = (struct hw_common *)touchscreen_dev;
 	return 0;
@@ -162,7 +558,14 @@ static int touchscreen_close(struct hw_common *common)
 		return -EINVAL;
 
 	free(common);
-	free(touchscreen_node);
+	if (--touchscreen_refcnt > 0)
+		return 0;
+
+	touchscreen_stop_worker();
+	unregister_udev_event_control(&uh);
+	uevent_control_udev_stop();
+	g_list_free_full(touchscreens, touchscreen_free);
+	touchscreens = NULL;
 	return 0;
 }
 
@@ -0,0 +1,41 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2015 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __TOUCHSCREEN_EXT_H__
+#define __TOUCHSCREEN_EXT_H__
+
+#include <hw/touchscreen.h>
+
+/* Called from the main loop once the state is applied (result is 0 or -errno) */
+typedef void (*TouchscreenSetDone)(enum touchscreen_state state, int result, void *data);
+
+/*
+ * Pico specific touchscreen device.
+ * touchscreen_open() always returns this structure, so callers which know
+ * about the extension can cast the returned hw_common to it.
+ */
+struct touchscreen_device_ext {
+	struct touchscreen_device dev;
+
+	/* Returns at once, the driver is written from a worker thread */
+	int (*set_state_async)(enum touchscreen_state state,
+			TouchscreenSetDone done_cb, void *data);
+};
+
+#endif /* __TOUCHSCREEN_EXT_H__ */
@@ -0,0 +1,221 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Instrumentation of the modules: every point below updates the
+ * counters of the module (see stats.h) and, with ENABLE_TRACE
+ * (cmake -DTRACE=ON), fires a static tracepoint of the provider
+ * "device_manager_pico":
+ *
+ *   op_entry(module, op)
+ *   op_exit(module, op, duration_ns)
+ *   sysfs_read(module, path, duration_ns, result)
+ *   sysfs_write(module, path, duration_ns, result)
+ *   dev_read(module, path, duration_ns, result)
+ *   dev_write(module, path, duration_ns, result)
+ *   proc_read(module, path, duration_ns, result)
+ *   uevent(subsystem, handler, duration_ns)
+ *
+ * Without ENABLE_TRACE the tracepoints expand to nothing and the
+ * durations are only measured once pico_stats_set_timing() enabled
+ * them, the counters are always updated.
+ *
+ * Each source defines TRACE_MODULE before including this header. The
+ * sys_* helpers of hw/shared.h are redirected to instrumented ones.
+ * An operation returns through TRACE_RET() to have its errors counted.
+ */
+
+#ifndef TRACE_MODULE
+#error "TRACE_MODULE must be defined before including trace.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <hw/shared.h>
+#include "stats.h"
+
+#ifdef ENABLE_TRACE
+#include <sys/sdt.h>
+#define TRACE_PROBE2(name, a, b)        DTRACE_PROBE2(device_manager_pico, name, a, b)
+#define TRACE_PROBE3(name, a, b, c)     DTRACE_PROBE3(device_manager_pico, name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d)  DTRACE_PROBE4(device_manager_pico, name, a, b, c, d)
+#else
+/* arguments are not evaluated, sizeof only keeps them "used" */
+#define TRACE_PROBE2(name, a, b)        do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define TRACE_PROBE3(name, a, b, c)     do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define TRACE_PROBE4(name, a, b, c, d)  do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#endif
+
+static struct pico_stats_entry trace_stats = { .module = TRACE_MODULE };
+
+static void __attribute__((constructor)) trace_stats_register(void)
+{
+	pico_stats_register(&trace_stats);
+}
+
+static void __attribute__((destructor)) trace_stats_unregister(void)
+{
+	pico_stats_unregister(&trace_stats);
+}
+
+#define TRACE_COUNT(field, n) \
+	__atomic_add_fetch(&trace_stats.stats.field, (n), __ATOMIC_RELAXED)
+
+#ifdef ENABLE_TRACE
+#define TRACE_TIMING()  1
+#else
+#define TRACE_TIMING()  __atomic_load_n(&pico_stats_timing, __ATOMIC_RELAXED)
+#endif
+
+/* 0 when the durations are not measured */
+static inline uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	if (!TRACE_TIMING())
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t trace_elapsed(uint64_t start)
+{
+	uint64_t now;
+
+	if (!start)
+		return 0;
+	now = trace_now();
+	return now > start ? now - start : 0;
+}
+
+struct trace_op {
+	const char *op;
+	uint64_t start;
+	int ret;
+};
+
+static inline void trace_op_exit(struct trace_op *t)
+{
+	uint64_t d = trace_elapsed(t->start);
+
+	TRACE_COUNT(calls, 1);
+	if (t->ret < 0)
+		TRACE_COUNT(op_errors, 1);
+	TRACE_COUNT(op_time_ns, d);
+	TRACE_PROBE3(op_exit, TRACE_MODULE, t->op, d);
+}
+
+/* op_exit runs when the calling scope is left, whatever the return */
+#define TRACE_OP(name) \
+	struct trace_op __trace_op __attribute__((cleanup(trace_op_exit))) = \
+		{ name, trace_now(), 0 }; \
+	TRACE_PROBE2(op_entry, TRACE_MODULE, name)
+
+/* return TRACE_RET(ret); lets op_exit see the result of the operation */
+#define TRACE_RET(r)  (__trace_op.ret = (r))
+
+#define TRACE_BEGIN(t) uint64_t t = trace_now()
+
+/*
+ * An access of 'kind' (sysfs, dev or proc) which read or wrote 'result'
+ * bytes, or failed when 'result' is negative.
+ */
+#define TRACE_IO(kind, op, bytes, path, t, result) \
+	do { \
+		uint64_t __d = trace_elapsed(t); \
+		long __r = (result); \
+		TRACE_COUNT(kind##_##op##s, 1); \
+		TRACE_COUNT(kind##_time_ns, __d); \
+		if (__r < 0) \
+			TRACE_COUNT(errors, 1); \
+		else \
+			TRACE_COUNT(bytes, __r); \
+		TRACE_PROBE4(kind##_##op, TRACE_MODULE, path, __d, __r); \
+	} while (0)
+
+#define TRACE_SYSFS_READ(path, t, result)   TRACE_IO(sysfs, read, bytes_read, path, t, result)
+#define TRACE_SYSFS_WRITE(path, t, result)  TRACE_IO(sysfs, write, bytes_written, path, t, result)
+#define TRACE_DEV_READ(path, t, result)     TRACE_IO(dev, read, bytes_read, path, t, result)
+#define TRACE_DEV_WRITE(path, t, result)    TRACE_IO(dev, write, bytes_written, path, t, result)
+#define TRACE_PROC_READ(path, t, result)    TRACE_IO(proc, read, bytes_read, path, t, result)
+
+#define TRACE_UEVENT_RECEIVED()  TRACE_COUNT(uevents_received, 1)
+
+#define TRACE_UEVENT(subsystem, func, t) \
+	do { \
+		TRACE_COUNT(uevents_dispatched, 1); \
+		TRACE_PROBE3(uevent, subsystem, func, trace_elapsed(t)); \
+	} while (0)
+
+/* the sys_* helpers do not tell the size, count the formatted one */
+static inline long trace_int_len(int val)
+{
+	char buf[16];
+
+	return snprintf(buf, sizeof(buf), "%d", val);
+}
+
+static inline int trace_sys_get_int(char *fname, int *val)
+{
+	TRACE_BEGIN(t);
+	int ret = sys_get_int(fname, val);
+
+	TRACE_SYSFS_READ(fname, t, ret < 0 ? ret : trace_int_len(*val));
+	return ret;
+}
+
+static inline int trace_sys_get_str(char *fname, char *str, int len)
+{
+	TRACE_BEGIN(t);
+	int ret = sys_get_str(fname, str, len);
+
+	TRACE_SYSFS_READ(fname, t, ret < 0 ? ret : (long)strlen(str));
+	return ret;
+}
+
+static inline int trace_sys_set_int(char *fname, int val)
+{
+	TRACE_BEGIN(t);
+	int ret = sys_set_int(fname, val);
+
+	TRACE_SYSFS_WRITE(fname, t, ret < 0 ? ret : trace_int_len(val));
+	return ret;
+}
+
+static inline int trace_sys_set_str(char *fname, char *val)
+{
+	TRACE_BEGIN(t);
+	int ret = sys_set_str(fname, val);
+
+	TRACE_SYSFS_WRITE(fname, t, ret < 0 ? ret : (long)strlen(val));
+	return ret;
+}
+
+#define sys_get_int(fname, val)       trace_sys_get_int(fname, val)
+#define sys_get_str(fname, str, len)  trace_sys_get_str(fname, str, len)
+#define sys_set_int(fname, val)       trace_sys_set_int(fname, val)
+#define sys_set_str(fname, val)       trace_sys_set_str(fname, val)
+
+#endif /* __TRACE_H__ */
@@ -26,6 +26,9 @@
 #include <hw/shared.h>
 #include "udev.h"
 
+#define TRACE_MODULE "udev"
+#include "trace.h"
+
 #define EVENT_KERNEL       "kernel"
 #define EVENT_UDEV         "udev"
 
@@ -36,6 +39,7 @@ struct uevent_info {
 	GIOChannel *ch;
 	guint eventid;
 	GList *event_list;
+	int refcnt;   /* users of the monitor */
 };
 
 
@@ -52,7 +56,6 @@ static gboolean uevent_control_cb(GIOChannel *channel,
 	struct uevent_handler *l;
 	GList *elem;
 	const char *subsystem;
-	int len;
 
 	if (!info) {
 		_E("data is invalid");
@@ -62,20 +65,21 @@ static gboolean uevent_control_cb(GIOChannel *channel,
 	dev = udev_monitor_receive_device(info->mon);
 	if (!dev)
 		return TRUE;
+	TRACE_UEVENT_RECEIVED();
 
 	subsystem = udev_device_get_subsystem(dev);
 	if (!subsystem)
 		goto out;
 
-	len = strlen(subsystem);
-
 	for (elem = info->event_list ; elem ; elem = g_list_next(elem)) {
 		l = elem->data;
 		if (!l)
 			continue;
-		if (!strncmp(l->subsystem, subsystem, len) &&
-		    l->uevent_func)
-			l->uevent_func(dev);
+		if (strcmp(l->subsystem, subsystem) || !l->uevent_func)
+			continue;
+		TRACE_BEGIN(t);
+		l->uevent_func(dev);
+		TRACE_UEVENT(subsystem, l->uevent_func, t);
 	}
 
 out:
@@ -121,9 +125,10 @@ static int uevent_control_start(const char *type,
 	if (!info)
 		return -EINVAL;
 
+	/* modules built together share the monitor */
 	if (info->mon) {
-		_E("%s uevent control routine is alreay started", type);
-		return -EINVAL;
+		info->refcnt++;
+		return 0;
 	}
 
 	if (!udev) {
@@ -183,12 +188,21 @@ static int uevent_control_start(const char *type,
 		goto stop;
 	}
 
+	info->refcnt = 1;
 	return 0;
 stop:
 	uevent_control_stop(info);
 	return -EINVAL;
 }
 
+static void uevent_control_put(struct uevent_info *info)
+{
+	if (info->refcnt == 0 || --info->refcnt > 0)
+		return;
+
+	uevent_control_stop(info);
+}
+
 int uevent_control_kernel_start(void)
 {
 	return uevent_control_start(EVENT_KERNEL, &kevent);
@@ -196,7 +210,7 @@ int uevent_control_kernel_start(void)
 
 void uevent_control_kernel_stop(void)
 {
-	uevent_control_stop(&kevent);
+	uevent_control_put(&kevent);
 }
 
 int uevent_control_udev_start(void)
@@ -206,17 +220,59 @@ int uevent_control_udev_start(void)
 
 void uevent_control_udev_stop(void)
 {
-	uevent_control_stop(&uevent);
+	uevent_control_put(&uevent);
 }
 
-static int register_uevent_control(struct uevent_info *info,
-		struct uevent_handler *uh)
+static bool uevent_subsystem_listed(struct uevent_info *info,
+		const char *subsystem)
+{
+	struct uevent_handler *l;
+	GList *elem;
+
+	for (elem = info->event_list ; elem ; elem = g_list_next(elem)) {
+		l = elem->data;
+		if (!strcmp(l->subsystem, subsystem))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Let the kernel drop the events of the subsystems nobody listens to.
+ * An empty filter would let every event through, so the last one is
+ * kept when no handler is left: its events find nobody to dispatch to.
+ */
+static int uevent_filter_rebuild(struct uevent_info *info)
 {
 	struct uevent_handler *l;
 	GList *elem;
 	int r;
-	bool matched = false;
-	int len;
+
+	if (!info->event_list)
+		return 0;
+
+	r = udev_monitor_filter_remove(info->mon);
+	if (r < 0)
+		return r;
+
+	for (elem = info->event_list ; elem ; elem = g_list_next(elem)) {
+		l = elem->data;
+		r = udev_monitor_filter_add_match_subsystem_devtype(info->mon,
+				l->subsystem, NULL);
+		if (r < 0)
+			_E("fail to add %s subsystem : %d", l->subsystem, r);
+	}
+
+	r = udev_monitor_filter_update(info->mon);
+	if (r < 0)
+		_E("fail to update udev monitor filter : %d", r);
+	return 0;
+}
+
+static int register_uevent_control(struct uevent_info *info,
+		struct uevent_handler *uh)
+{
+	int r;
 
 	if (!info || !uh || !uh->subsystem)
 		return -EINVAL;
@@ -225,29 +281,19 @@ static int register_uevent_control(struct uevent_info *info,
 	if (!udev || !info->mon)
 		goto add_list;
 
-	len = strlen(uh->subsystem);
-	/* check if the same subsystem is already added */
-	for (elem = info->event_list; elem ; elem = g_list_next(elem)) {
-		l = elem->data;
-		if (!strncmp(l->subsystem, uh->subsystem, len)) {
-			matched = true;
-			break;
-		}
-	}
-
 	/* the first request to add subsystem */
-	if (!matched) {
+	if (!uevent_subsystem_listed(info, uh->subsystem)) {
 		r = udev_monitor_filter_add_match_subsystem_devtype(info->mon,
 				uh->subsystem, NULL);
 		if (r < 0) {
 			_E("fail to add %s subsystem : %d", uh->subsystem, r);
 			return -EPERM;
 		}
-	}
 
-	r = udev_monitor_filter_update(info->mon);
-	if (r < 0)
-		_E("fail to update udev monitor filter : %d", r);
+		r = udev_monitor_filter_update(info->mon);
+		if (r < 0)
+			_E("fail to update udev monitor filter : %d", r);
+	}
 
 add_list:
 	info->event_list = g_list_append(info->event_list, uh);
@@ -258,19 +304,24 @@ static int unregister_uevent_control(struct uevent_info *info,
 		const struct uevent_handler *uh)
 {
 	struct uevent_handler *l;
-	GList *n, *next;
-	int len;
+	GList *n;
+	int r;
 
 	if (!info || !uh || !uh->subsystem)
 		return -EINVAL;
 
-	len = strlen(uh->subsystem);
-	for (n = info->event_list, next = g_list_next(n) ;
-			n ; n = next, next = g_list_next(n)) {
+	for (n = info->event_list ; n ; n = g_list_next(n)) {
 		l = n->data;
-		if (!strncmp(l->subsystem, uh->subsystem, len) &&
+		if (!strcmp(l->subsystem, uh->subsystem) &&
 		    l->uevent_func == uh->uevent_func) {
 			info->event_list = g_list_delete_link(info->event_list, n);
+			if (!info->mon || uevent_subsystem_listed(info, uh->subsystem))
+				return 0;
+			/* on failure its events keep coming, nobody handles them */
+			r = uevent_filter_rebuild(info);
+			if (r < 0)
+				_E("fail to remove %s subsystem filter : %d",
+						uh->subsystem, r);
 			return 0;
 		}
 	}
@@ -28,6 +28,11 @@ struct uevent_handler {
 	void *data;
 };
 
+/*
+ * The uevent core is shared by all the modules of a process, each kind
+ * of event is received on a single socket. start/stop are refcounted,
+ * so every module starts and stops the control on its own.
+ */
 int uevent_control_kernel_start(void);
 void uevent_control_kernel_stop(void);
 
@@ -16,7 +16,1469 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <time.h>
+#include <gio/gio.h>
+
 #include <hw/usb_client.h>
+#include <hw/shared.h>
+#include "usb_cfs_client_ext.h"
+
+#define TRACE_MODULE "usb_cfs_client"
+#include "../trace.h"
+
+#ifndef CONFIGFS_GADGET_PATH
+#define CONFIGFS_GADGET_PATH "/sys/kernel/config/usb_gadget"
+#endif
+#ifndef UDC_PATH
+#define UDC_PATH "/sys/class/udc"
+#endif
+#ifndef FFS_PATH
+#define FFS_PATH "/dev/usb-funcs"
+#endif
+#ifndef USB_GADGET_POOL_CONF
+#define USB_GADGET_POOL_CONF "/etc/deviced/usb-gadget-pool.conf"
+#endif
+
+#define SYSTEMD_DBUS_DEST   "org.freedesktop.systemd1"
+#define SYSTEMD_DBUS_PATH   "/org/freedesktop/systemd1"
+#define SYSTEMD_DBUS_IFACE  "org.freedesktop.systemd1.Manager"
+
+#define GADGET_NAME   "hal-gadget"
+#define CONFIG_LABEL  "c"
+#define MAX_CONFIGS   4
+#define MAX_FUNCS     16
+#define VALUE_LEN     128
+
+/* Names of the functions linked into a configuration */
+struct cfs_links {
+	int nr;
+	bool ordered;  /* false if the link order is unknown */
+	char name[MAX_FUNCS][NAME_MAX];
+};
+
+/* Kernel function types usable in a simple (no daemon) function */
+static const char *const simple_types[] = {
+	"acm", "rndis", "ecm", "ncm", "eem", "mass_storage", "hid", "midi",
+	"gser", "obex", "uac1", "uac2", "uvc", "loopback", "sourcesink",
+};
+
+/* A gadget directory of configfs */
+struct cfs_gadget {
+	char name[NAME_MAX];
+	char path[PATH_MAX];
+	/*
+	 * Gadget last written to the directory, NULL if unknown. It keeps
+	 * the order of the links, which configfs does not tell.
+	 */
+	struct usb_gadget *applied;
+	bool partial;  /* an apply failed midway, the tree may differ from applied */
+	bool pooled;
+	struct usb_mode_stats stats;
+	unsigned long long total_us;
+};
+
+/* Gadget built on demand for the modes missing from the pool */
+static struct cfs_gadget main_gadget = {
+	.name = "default",
+	.path = CONFIGFS_GADGET_PATH "/" GADGET_NAME,
+};
+
+/* Gadgets prepared at open, one per mode of USB_GADGET_POOL_CONF */
+static struct cfs_gadget *pool;
+static int pool_nr;
+
+/* Gadget selected by the last reconfigure and the one bound to the UDC */
+static struct cfs_gadget *active = &main_gadget;
+static struct cfs_gadget *bound;
+
+/* Start of the switch in progress, completed when the UDC is bound */
+static struct timespec switch_start;
+static unsigned int switch_syscalls;
+static unsigned long long switch_bytes;
+static struct cfs_gadget *switching;
+
+/* Last gadget applied by reconfigure_gadget, for get_current_gadget */
+static struct usb_gadget *cur_gadget;
+static int refcount;
+
+/* I/O done on the gadget trees, accounted to the switches */
+static struct {
+	unsigned int syscalls;
+	unsigned long long bytes;
+} io;
+
+#define CFS_IO(call) (io.syscalls++, (call))
+
+static DIR *cfs_opendir(const char *path)
+{
+	/* openat and, for these small directories, two getdents */
+	io.syscalls += 3;
+	return opendir(path);
+}
+
+static int cfs_read(const char *path, char *buf, size_t size)
+{
+	int fd;
+	ssize_t n;
+
+	TRACE_BEGIN(t);
+	fd = CFS_IO(open(path, O_RDONLY | O_CLOEXEC));
+	if (fd < 0)
+		return -errno;
+
+	n = CFS_IO(read(fd, buf, size - 1));
+	CFS_IO(close(fd));
+	TRACE_SYSFS_READ(path, t, n);
+	if (n < 0)
+		return -errno;
+
+	buf[n] = '\0';
+	while (n > 0 && buf[n - 1] == '\n')
+		buf[--n] = '\0';
+	return 0;
+}
+
+static int cfs_write(const char *path, const char *val)
+{
+	int fd;
+	ssize_t n;
+	size_t len = strlen(val);
+
+	TRACE_BEGIN(t);
+	fd = CFS_IO(open(path, O_WRONLY | O_TRUNC | O_CLOEXEC));
+	if (fd < 0)
+		return -errno;
+
+	n = CFS_IO(write(fd, val, len));
+	CFS_IO(close(fd));
+	TRACE_SYSFS_WRITE(path, t, n);
+	if (n < 0)
+		return -errno;
+	io.bytes += n;
+	if ((size_t)n != len)
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Diff helpers: they return the number of differences found, which
+ * are fixed when 'apply' is set, or a negative errno.
+ */
+static int cfs_sync_value(const char *path, const char *val, bool apply)
+{
+	char cur[VALUE_LEN];
+	int ret;
+
+	if (cfs_read(path, cur, sizeof(cur)) == 0 && !strcmp(cur, val))
+		return 0;
+	if (!apply)
+		return 1;
+
+	ret = cfs_write(path, val);
+	if (ret < 0) {
+		_E("Failed to write %s to %s (%d)", val, path, ret);
+		return ret;
+	}
+	return 1;
+}
+
+static int cfs_sync_hex(const char *path, unsigned int val, bool apply)
+{
+	char cur[VALUE_LEN], buf[16];
+
+	/* attributes read back as 0x%04x, compare the numbers */
+	if (cfs_read(path, cur, sizeof(cur)) == 0 &&
+	    strtoul(cur, NULL, 0) == val)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "0x%04x", val);
+	return cfs_sync_value(path, buf, apply);
+}
+
+static int cfs_sync_dir(const char *path, bool apply)
+{
+	struct stat st;
+
+	if (CFS_IO(stat(path, &st)) == 0)
+		return 0;
+	if (!apply)
+		return 1;
+
+	if (CFS_IO(mkdir(path, 0755)) < 0 && errno != EEXIST) {
+		_E("Failed to create %s (%d)", path, errno);
+		return -errno;
+	}
+	return 1;
+}
+
+/* Queue a start or stop job of a unit, without waiting for it */
+static int cfs_systemd_unit(const char *method, const char *unit)
+{
+	GDBusConnection *conn;
+	GVariant *reply;
+	GError *err = NULL;
+
+	conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &err);
+	if (!conn) {
+		_E("Failed to get the system bus (%s)", err ? err->message : "");
+		if (err)
+			g_error_free(err);
+		return -ECOMM;
+	}
+
+	reply = g_dbus_connection_call_sync(conn, SYSTEMD_DBUS_DEST,
+			SYSTEMD_DBUS_PATH, SYSTEMD_DBUS_IFACE, method,
+			g_variant_new("(ss)", unit, "replace"), NULL,
+			G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err);
+	g_object_unref(conn);
+	if (!reply) {
+		_E("Failed to %s %s (%s)", method, unit, err ? err->message : "");
+		if (err)
+			g_error_free(err);
+		return -EIO;
+	}
+
+	g_variant_unref(reply);
+	return 0;
+}
+
+static int cfs_service_unit(const char *method, const char *service,
+		const char *type)
+{
+	char unit[NAME_MAX];
+
+	snprintf(unit, sizeof(unit), "%s.%s", service, type);
+	return cfs_systemd_unit(method, unit);
+}
+
+static const char *cfs_function_service(struct usb_function *func)
+{
+	if (func->function_group != USB_FUNCTION_GROUP_WITH_SERVICE)
+		return NULL;
+	return container_of(func, struct usb_function_with_service, func)->service;
+}
+
+/* rndis needs its network interface set up by rndis.service */
+static void cfs_rndis_handler(bool enable)
+{
+	cfs_systemd_unit(enable ? "StartUnit" : "StopUnit", "rndis.service");
+}
+
+/* Work done for a function when its gadget is bound or unbound */
+static const struct {
+	const char *name;
+	void (*handler)(bool enable);
+} function_handlers[] = {
+	{ "rndis", cfs_rndis_handler },
+};
+
+/*
+ * The daemons behind the functionfs functions are started before the
+ * gadget is bound and stopped once it is unbound, then the handlers of
+ * the functions are run.
+ */
+static void cfs_run_services(struct usb_gadget *gadget, bool enable)
+{
+	struct usb_function *func;
+	const char *service;
+	unsigned int k;
+	int i, j;
+
+	if (!gadget)
+		return;
+
+	for (i = 0 ; gadget->configs[i] ; i++) {
+		for (j = 0 ; gadget->configs[i]->funcs[j] ; j++) {
+			func = gadget->configs[i]->funcs[j];
+			service = cfs_function_service(func);
+			if (service)
+				cfs_service_unit(enable ? "StartUnit" : "StopUnit",
+						service, "service");
+			for (k = 0 ; k < ARRAY_SIZE(function_handlers) ; k++) {
+				if (!strcmp(func->name, function_handlers[k].name))
+					function_handlers[k].handler(enable);
+			}
+		}
+	}
+}
+
+/*
+ * functionfs functions are "ffs.<name>.<instance>", the instance of
+ * the function being the device name of the functionfs mount.
+ */
+static void cfs_function_name(struct usb_function *func, char *buf, size_t size)
+{
+	if (func->function_group == USB_FUNCTION_GROUP_WITH_SERVICE)
+		snprintf(buf, size, "ffs.%s.%s", func->name,
+				func->instance ? func->instance : "default");
+	else
+		snprintf(buf, size, "%s.%s", func->name,
+				func->instance ? func->instance : "default");
+}
+
+/* FFS_PATH/<name>/<instance> of a functionfs function */
+static int cfs_ffs_path(const char *name, char *buf, size_t size)
+{
+	const char *dot = strchr(name + 4, '.');
+
+	if (!dot)
+		return -EINVAL;
+	snprintf(buf, size, "%s/%.*s/%s", FFS_PATH,
+			(int)(dot - name - 4), name + 4, dot + 1);
+	return 0;
+}
+
+static bool cfs_is_ffs(const char *name)
+{
+	return !strncmp(name, "ffs.", 4);
+}
+
+static void cfs_wanted_links(struct usb_configuration *config, struct cfs_links *links)
+{
+	int i;
+
+	links->nr = 0;
+	links->ordered = true;
+	for (i = 0 ; config->funcs && i < MAX_FUNCS && config->funcs[i] ; i++)
+		cfs_function_name(config->funcs[i], links->name[links->nr++], NAME_MAX);
+}
+
+static bool cfs_links_contain(struct cfs_links *links, const char *name)
+{
+	int i;
+
+	for (i = 0 ; i < links->nr ; i++) {
+		if (!strcmp(links->name[i], name))
+			return true;
+	}
+	return false;
+}
+
+/* The id of a config dir named <CONFIG_LABEL>.<id>, 0 if foreign */
+static int cfs_config_id(const char *name)
+{
+	size_t len = strlen(CONFIG_LABEL);
+
+	if (strncmp(name, CONFIG_LABEL, len) || name[len] != '.')
+		return 0;
+	return atoi(name + len + 1);
+}
+
+/* Links of configs/<config>, in creation order if it is known */
+static int cfs_read_links(struct cfs_gadget *g, const char *config,
+		struct cfs_links *links)
+{
+	char path[PATH_MAX];
+	struct cfs_links last;
+	struct dirent *dir;
+	DIR *d;
+	int i, id;
+
+	links->nr = 0;
+	links->ordered = false;
+	snprintf(path, sizeof(path), "%s/configs/%s", g->path, config);
+	d = cfs_opendir(path);
+	if (!d)
+		return (errno == ENOENT) ? 0 : -errno;
+
+	while ((dir = readdir(d)) && links->nr < MAX_FUNCS) {
+		if (dir->d_type != DT_LNK)
+			continue;
+		snprintf(links->name[links->nr++], NAME_MAX, "%s", dir->d_name);
+	}
+	CFS_IO(closedir(d));
+
+	/*
+	 * readdir does not tell the link order, which sets the interface
+	 * numbers. A switch only drops the tail of the links set by the
+	 * last one, so if the links are the head of those of its gadget
+	 * the order is taken from it. Else the order stays unknown and the
+	 * links of the config are all made again.
+	 */
+	id = cfs_config_id(config);
+	if (g->applied && !g->partial && id > 0) {
+		for (i = 0 ; i < id && g->applied->configs[i] ; i++)
+			;
+		if (i == id) {
+			cfs_wanted_links(g->applied->configs[id - 1], &last);
+			if (links->nr > last.nr)
+				return 0;
+			last.nr = links->nr;
+			for (i = 0 ; i < links->nr ; i++) {
+				if (!cfs_links_contain(&last, links->name[i]))
+					break;
+			}
+			if (i == links->nr)
+				*links = last;
+		}
+	}
+
+	return 0;
+}
+
+/* Length of the common head of two link lists, kept by a switch */
+static int cfs_common_links(struct cfs_links *a, struct cfs_links *b)
+{
+	int i;
+
+	if (!a->ordered || !b->ordered)
+		return 0;
+
+	for (i = 0 ; i < a->nr && i < b->nr ; i++) {
+		if (strcmp(a->name[i], b->name[i]))
+			break;
+	}
+	return i;
+}
+
+static int cfs_unlink_from(struct cfs_gadget *g, const char *config,
+		struct cfs_links *cur, int from, bool apply)
+{
+	char path[PATH_MAX];
+	int i;
+
+	if (!apply)
+		return cur->nr - from;
+
+	for (i = cur->nr - 1 ; i >= from ; i--) {
+		snprintf(path, sizeof(path), "%s/configs/%s/%s",
+				g->path, config, cur->name[i]);
+		if (CFS_IO(unlink(path)) < 0) {
+			_E("Failed to unlink %s (%d)", path, errno);
+			return -errno;
+		}
+	}
+	return cur->nr - from;
+}
+
+static int cfs_remove_config(struct cfs_gadget *g, const char *config, bool apply)
+{
+	char path[PATH_MAX];
+	struct cfs_links cur;
+	struct dirent *dir;
+	DIR *d;
+	int ret;
+
+	ret = cfs_read_links(g, config, &cur);
+	if (ret < 0)
+		return ret;
+	ret = cfs_unlink_from(g, config, &cur, 0, apply);
+	if (ret < 0)
+		return ret;
+	if (!apply)
+		return ret + 1;
+
+	snprintf(path, sizeof(path), "%s/configs/%s/strings", g->path, config);
+	d = cfs_opendir(path);
+	if (d) {
+		while ((dir = readdir(d))) {
+			if (dir->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/configs/%s/strings/%s",
+					g->path, config, dir->d_name);
+			CFS_IO(rmdir(path));
+		}
+		CFS_IO(closedir(d));
+	}
+
+	snprintf(path, sizeof(path), "%s/configs/%s", g->path, config);
+	if (CFS_IO(rmdir(path)) < 0) {
+		_E("Failed to remove %s (%d)", path, errno);
+		return -errno;
+	}
+	return ret + 1;
+}
+
+/* Drop the links and configs which are not part of the new gadget */
+static int cfs_sync_unlink(struct cfs_gadget *g, struct usb_gadget *gadget,
+		int nr_configs, bool apply)
+{
+	char path[PATH_MAX];
+	struct cfs_links cur, want;
+	struct dirent *dir;
+	DIR *d;
+	int id, ret, changes = 0;
+
+	snprintf(path, sizeof(path), "%s/configs", g->path);
+	d = cfs_opendir(path);
+	if (!d)
+		return 0;
+
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.')
+			continue;
+
+		id = cfs_config_id(dir->d_name);
+		if (id <= 0 || id > nr_configs) {
+			ret = cfs_remove_config(g, dir->d_name, apply);
+			goto next;
+		}
+
+		ret = cfs_read_links(g, dir->d_name, &cur);
+		if (ret < 0)
+			goto next;
+		cfs_wanted_links(gadget->configs[id - 1], &want);
+		ret = cfs_unlink_from(g, dir->d_name, &cur,
+				cfs_common_links(&cur, &want), apply);
+next:
+		if (ret < 0) {
+			CFS_IO(closedir(d));
+			return ret;
+		}
+		changes += ret;
+	}
+	CFS_IO(closedir(d));
+
+	return changes;
+}
+
+static struct usb_function *cfs_find_function(struct usb_gadget *gadget,
+		const char *name)
+{
+	char buf[NAME_MAX];
+	int i, j;
+
+	for (i = 0 ; gadget->configs[i] ; i++) {
+		for (j = 0 ; gadget->configs[i]->funcs[j] ; j++) {
+			cfs_function_name(gadget->configs[i]->funcs[j], buf, sizeof(buf));
+			if (!strcmp(buf, name))
+				return gadget->configs[i]->funcs[j];
+		}
+	}
+	return NULL;
+}
+
+static int cfs_remove_function(struct cfs_gadget *g, const char *name)
+{
+	char path[PATH_MAX];
+	struct usb_function *func;
+	const char *service;
+
+	if (cfs_is_ffs(name) && cfs_ffs_path(name, path, sizeof(path)) == 0) {
+		/* the socket of a function left by a previous instance is unknown */
+		func = g->applied ? cfs_find_function(g->applied, name) : NULL;
+		service = func ? cfs_function_service(func) : NULL;
+		if (service)
+			cfs_service_unit("StopUnit", service, "socket");
+		CFS_IO(umount2(path, MNT_DETACH));
+	}
+
+	snprintf(path, sizeof(path), "%s/functions/%s", g->path, name);
+	if (CFS_IO(rmdir(path)) < 0) {
+		_E("Failed to remove function %s (%d)", name, errno);
+		return -errno;
+	}
+	return 0;
+}
+
+static int cfs_create_function(struct cfs_gadget *g, struct usb_function *func)
+{
+	char path[PATH_MAX], name[NAME_MAX];
+	const char *service;
+	int ret;
+
+	cfs_function_name(func, name, sizeof(name));
+	snprintf(path, sizeof(path), "%s/functions/%s", g->path, name);
+	if (CFS_IO(mkdir(path, 0755)) < 0 && errno != EEXIST) {
+		_E("Failed to create function %s (%d)", name, errno);
+		return -errno;
+	}
+
+	service = cfs_function_service(func);
+	if (!service)
+		return 0;
+
+	/*
+	 * The daemon behind a functionfs function (sdbd, mtp-responder)
+	 * is activated by its socket unit, which listens on the endpoint 0
+	 * of FFS_PATH/<name>/<instance>.
+	 */
+	snprintf(path, sizeof(path), "%s", FFS_PATH);
+	CFS_IO(mkdir(path, 0755));
+	snprintf(path, sizeof(path), "%s/%s", FFS_PATH, func->name);
+	CFS_IO(mkdir(path, 0755));
+	cfs_ffs_path(name, path, sizeof(path));
+	CFS_IO(mkdir(path, 0755));
+	if (CFS_IO(mount(name + 4, path, "functionfs", 0, NULL)) < 0 && errno != EBUSY) {
+		_E("Failed to mount functionfs for %s (%d)", name, errno);
+		return -errno;
+	}
+
+	ret = cfs_service_unit("StartUnit", service, "socket");
+	if (ret < 0) {
+		CFS_IO(umount2(path, MNT_DETACH));
+		return ret;
+	}
+	return 0;
+}
+
+static int cfs_sync_functions(struct cfs_gadget *g, struct usb_gadget *gadget,
+		bool apply)
+{
+	char path[PATH_MAX], name[NAME_MAX];
+	struct usb_function *func;
+	struct dirent *dir;
+	struct stat st;
+	DIR *d;
+	int i, j, ret, changes = 0;
+
+	snprintf(path, sizeof(path), "%s/functions", g->path);
+	d = cfs_opendir(path);
+	if (d) {
+		while ((dir = readdir(d))) {
+			if (dir->d_name[0] == '.')
+				continue;
+			if (cfs_find_function(gadget, dir->d_name))
+				continue;
+			changes++;
+			if (!apply)
+				continue;
+			ret = cfs_remove_function(g, dir->d_name);
+			if (ret < 0) {
+				CFS_IO(closedir(d));
+				return ret;
+			}
+		}
+		CFS_IO(closedir(d));
+	}
+
+	for (i = 0 ; gadget->configs[i] ; i++) {
+		for (j = 0 ; gadget->configs[i]->funcs[j] ; j++) {
+			func = gadget->configs[i]->funcs[j];
+			cfs_function_name(func, name, sizeof(name));
+			snprintf(path, sizeof(path), "%s/functions/%s", g->path, name);
+			if (CFS_IO(stat(path, &st)) == 0)
+				continue;
+			changes++;
+			if (!apply)
+				continue;
+			ret = cfs_create_function(g, func);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return changes;
+}
+
+#define SYNC(expr) \
+	do { \
+		ret = (expr); \
+		if (ret < 0) \
+			return ret; \
+		changes += ret; \
+	} while (0)
+
+static int cfs_sync_config(struct cfs_gadget *g, int id,
+		struct usb_configuration *config, bool apply)
+{
+	char dir[PATH_MAX], path[PATH_MAX], target[PATH_MAX], name[NAME_MAX];
+	struct cfs_links cur, want;
+	int i, k, ret, changes = 0;
+
+	snprintf(name, sizeof(name), "%s.%d", CONFIG_LABEL, id);
+	snprintf(dir, sizeof(dir), "%s/configs/%s", g->path, name);
+	SYNC(cfs_sync_dir(dir, apply));
+
+	snprintf(path, sizeof(path), "%s/MaxPower", dir);
+	snprintf(target, sizeof(target), "%d", config->attrs.MaxPower);
+	SYNC(cfs_sync_value(path, target, apply));
+	snprintf(path, sizeof(path), "%s/bmAttributes", dir);
+	SYNC(cfs_sync_hex(path, config->attrs.bmAttributs, apply));
+
+	for (i = 0 ; config->strs && config->strs[i].lang_code ; i++) {
+		snprintf(path, sizeof(path), "%s/strings/0x%x", dir, config->strs[i].lang_code);
+		SYNC(cfs_sync_dir(path, apply));
+		snprintf(path, sizeof(path), "%s/strings/0x%x/configuration",
+				dir, config->strs[i].lang_code);
+		SYNC(cfs_sync_value(path, config->strs[i].config_str ?
+					config->strs[i].config_str : "", apply));
+	}
+
+	ret = cfs_read_links(g, name, &cur);
+	if (ret < 0)
+		return ret;
+	cfs_wanted_links(config, &want);
+	k = cfs_common_links(&cur, &want);
+	if (!apply)
+		return changes + want.nr - k;
+
+	for (i = k ; i < want.nr ; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, want.name[i]);
+		snprintf(target, sizeof(target), "%s/functions/%s",
+				g->path, want.name[i]);
+		if (CFS_IO(symlink(target, path)) < 0) {
+			_E("Failed to link %s (%d)", want.name[i], errno);
+			return -errno;
+		}
+		changes++;
+	}
+
+	return changes;
+}
+
+static int cfs_sync_gadget(struct cfs_gadget *g, struct usb_gadget *gadget,
+		int nr_configs, bool apply)
+{
+	char path[PATH_MAX];
+	struct usb_gadget_strings *strs;
+	int i, ret, changes = 0;
+
+	SYNC(cfs_sync_dir(g->path, apply));
+	if (!apply && changes)
+		return changes;
+
+	SYNC(cfs_sync_unlink(g, gadget, nr_configs, apply));
+	SYNC(cfs_sync_functions(g, gadget, apply));
+	for (i = 0 ; i < nr_configs ; i++)
+		SYNC(cfs_sync_config(g, i + 1, gadget->configs[i], apply));
+
+	snprintf(path, sizeof(path), "%s/idVendor", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.idVendor, apply));
+	snprintf(path, sizeof(path), "%s/idProduct", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.idProduct, apply));
+	snprintf(path, sizeof(path), "%s/bcdDevice", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.bcdDevice, apply));
+	snprintf(path, sizeof(path), "%s/bDeviceClass", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.bDeviceClass, apply));
+	snprintf(path, sizeof(path), "%s/bDeviceSubClass", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.bDeviceSubClass, apply));
+	snprintf(path, sizeof(path), "%s/bDeviceProtocol", g->path);
+	SYNC(cfs_sync_hex(path, gadget->attrs.bDeviceProtocol, apply));
+
+	for (strs = gadget->strs ; strs && strs->lang_code ; strs++) {
+		snprintf(path, sizeof(path), "%s/strings/0x%x", g->path, strs->lang_code);
+		SYNC(cfs_sync_dir(path, apply));
+		snprintf(path, sizeof(path), "%s/strings/0x%x/manufacturer",
+				g->path, strs->lang_code);
+		SYNC(cfs_sync_value(path, strs->manufacturer ? strs->manufacturer : "", apply));
+		snprintf(path, sizeof(path), "%s/strings/0x%x/product",
+				g->path, strs->lang_code);
+		SYNC(cfs_sync_value(path, strs->product ? strs->product : "", apply));
+		snprintf(path, sizeof(path), "%s/strings/0x%x/serialnumber",
+				g->path, strs->lang_code);
+		SYNC(cfs_sync_value(path, strs->serial ? strs->serial : "", apply));
+	}
+
+	return changes;
+}
+
+#undef SYNC
+
+/* Name of the UDC the gadget is bound to, empty if it is not */
+static int cfs_get_udc(struct cfs_gadget *g, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/UDC", g->path);
+	return cfs_read(path, buf, size);
+}
+
+static int cfs_find_udc(char *buf, size_t size)
+{
+	struct dirent *dir;
+	DIR *d;
+
+	d = cfs_opendir(UDC_PATH);
+	if (!d)
+		return -ENODEV;
+
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.')
+			continue;
+		snprintf(buf, size, "%s", dir->d_name);
+		CFS_IO(closedir(d));
+		return 0;
+	}
+	CFS_IO(closedir(d));
+
+	return -ENODEV;
+}
+
+static int cfs_bind(struct cfs_gadget *g, const char *udc)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	cfs_run_services(g->applied, true);
+
+	snprintf(path, sizeof(path), "%s/UDC", g->path);
+	ret = cfs_write(path, udc);
+	if (ret < 0) {
+		_E("Failed to bind %s to %s (%d)", g->name, udc, ret);
+		cfs_run_services(g->applied, false);
+		return ret;
+	}
+
+	bound = g;
+	return 0;
+}
+
+static int cfs_unbind(struct cfs_gadget *g)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/UDC", g->path);
+	ret = cfs_write(path, "\n");
+	if (ret < 0) {
+		_E("Failed to unbind %s (%d)", g->name, ret);
+		return ret;
+	}
+
+	cfs_run_services(g->applied, false);
+
+	if (bound == g)
+		bound = NULL;
+	return 0;
+}
+
+/* Account the switch to 'g' once it is bound */
+static void cfs_switch_done(struct cfs_gadget *g)
+{
+	struct timespec now;
+	unsigned long long us;
+
+	if (switching != g)
+		return;
+	switching = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - switch_start.tv_sec) * 1000000ULL +
+		(now.tv_nsec - switch_start.tv_nsec) / 1000;
+
+	g->stats.switches++;
+	g->stats.last_us = us;
+	if (us > g->stats.max_us)
+		g->stats.max_us = us;
+	g->total_us += us;
+	g->stats.avg_us = g->total_us / g->stats.switches;
+	g->stats.last_syscalls = io.syscalls - switch_syscalls;
+	g->stats.last_bytes = io.bytes - switch_bytes;
+
+	_I("USB mode %s ready in %llu us, %u syscalls, %u bytes written%s",
+			g->name, us, g->stats.last_syscalls, g->stats.last_bytes,
+			g->pooled ? " (pooled)" : "");
+}
+
+static void cfs_free_gadget_impl(struct usb_gadget *gadget)
+{
+	int i, j;
+
+	if (!gadget)
+		return;
+
+	for (i = 0 ; gadget->strs && gadget->strs[i].lang_code ; i++) {
+		free(gadget->strs[i].manufacturer);
+		free(gadget->strs[i].product);
+		free(gadget->strs[i].serial);
+	}
+	free(gadget->strs);
+
+	for (i = 0 ; gadget->configs && gadget->configs[i] ; i++) {
+		struct usb_configuration *config = gadget->configs[i];
+
+		for (j = 0 ; config->strs && config->strs[j].lang_code ; j++)
+			free(config->strs[j].config_str);
+		free(config->strs);
+		for (j = 0 ; config->funcs && config->funcs[j] ; j++)
+			config->funcs[j]->free_func(config->funcs[j]);
+		free(config->funcs);
+		free(config);
+	}
+	free(gadget->configs);
+	free(gadget);
+}
+
+static void cfs_free_gadget(struct usb_gadget *gadget)
+{
+	TRACE_OP("cfs_free_gadget");
+
+	cfs_free_gadget_impl(gadget);
+}
+
+static struct usb_gadget *cfs_copy_gadget(struct usb_gadget *src)
+{
+	struct usb_gadget *gadget;
+	struct usb_configuration *config, *s;
+	int i, j, n;
+
+	gadget = calloc(1, sizeof(*gadget));
+	if (!gadget)
+		return NULL;
+	gadget->attrs = src->attrs;
+
+	for (n = 0 ; src->strs && src->strs[n].lang_code ; n++)
+		;
+	gadget->strs = calloc(n + 1, sizeof(*gadget->strs));
+	if (!gadget->strs)
+		goto err;
+	for (i = 0 ; i < n ; i++) {
+		gadget->strs[i].lang_code = src->strs[i].lang_code;
+		if (src->strs[i].manufacturer)
+			gadget->strs[i].manufacturer = strdup(src->strs[i].manufacturer);
+		if (src->strs[i].product)
+			gadget->strs[i].product = strdup(src->strs[i].product);
+		if (src->strs[i].serial)
+			gadget->strs[i].serial = strdup(src->strs[i].serial);
+	}
+
+	for (n = 0 ; src->configs[n] ; n++)
+		;
+	gadget->configs = calloc(n + 1, sizeof(*gadget->configs));
+	if (!gadget->configs)
+		goto err;
+
+	for (i = 0 ; i < n ; i++) {
+		s = src->configs[i];
+		config = calloc(1, sizeof(*config));
+		if (!config)
+			goto err;
+		gadget->configs[i] = config;
+		config->attrs = s->attrs;
+
+		for (j = 0 ; s->strs && s->strs[j].lang_code ; j++)
+			;
+		config->strs = calloc(j + 1, sizeof(*config->strs));
+		if (!config->strs)
+			goto err;
+		for (j = 0 ; s->strs && s->strs[j].lang_code ; j++) {
+			config->strs[j].lang_code = s->strs[j].lang_code;
+			if (s->strs[j].config_str)
+				config->strs[j].config_str = strdup(s->strs[j].config_str);
+		}
+
+		for (j = 0 ; s->funcs[j] ; j++)
+			;
+		config->funcs = calloc(j + 1, sizeof(*config->funcs));
+		if (!config->funcs)
+			goto err;
+		for (j = 0 ; s->funcs[j] ; j++) {
+			if (s->funcs[j]->clone(s->funcs[j], &config->funcs[j]) < 0) {
+				config->funcs[j] = NULL;
+				goto err;
+			}
+		}
+	}
+
+	return gadget;
+
+err:
+	cfs_free_gadget_impl(gadget);
+	return NULL;
+}
+
+static void pool_function_free(struct usb_function *func)
+{
+	free(func->name);
+	free(func->instance);
+	free(func);
+}
+
+/*
+ * Gadget of a pool line: "<mode> <function> [<function> ...]", where a
+ * function is "<type>.<instance>" or a bare "<type>". A bare type is
+ * made as "<type>.default" and matches any instance of that type.
+ */
+static struct usb_gadget *cfs_pool_parse(char *funcs)
+{
+	struct usb_gadget *gadget;
+	struct usb_configuration *config;
+	struct usb_function *func;
+	char *tok, *save, *dot;
+	int n = 0;
+
+	gadget = calloc(1, sizeof(*gadget));
+	if (!gadget)
+		return NULL;
+	gadget->strs = calloc(1, sizeof(*gadget->strs));
+	gadget->configs = calloc(2, sizeof(*gadget->configs));
+	if (!gadget->strs || !gadget->configs)
+		goto err;
+
+	config = calloc(1, sizeof(*config));
+	if (!config)
+		goto err;
+	gadget->configs[0] = config;
+	config->attrs.bmAttributs = 0x80;
+	config->attrs.MaxPower = 500;
+	config->strs = calloc(1, sizeof(*config->strs));
+	config->funcs = calloc(MAX_FUNCS + 1, sizeof(*config->funcs));
+	if (!config->strs || !config->funcs)
+		goto err;
+
+	for (tok = strtok_r(funcs, " \t\n", &save) ; tok ;
+	     tok = strtok_r(NULL, " \t\n", &save)) {
+		dot = strchr(tok, '.');
+		if (dot == tok || (dot && !dot[1]) || n == MAX_FUNCS)
+			goto err;
+		if (dot)
+			*dot = '\0';
+
+		/* functionfs instances are unique, they stay in the default gadget */
+		if (!strcmp(tok, "ffs"))
+			goto err;
+
+		func = calloc(1, sizeof(*func));
+		if (!func)
+			goto err;
+		config->funcs[n++] = func;
+		func->function_group = USB_FUNCTION_GROUP_SIMPLE;
+		func->name = strdup(tok);
+		func->instance = dot ? strdup(dot + 1) : NULL;
+		func->free_func = pool_function_free;
+		if (!func->name || (dot && !func->instance))
+			goto err;
+	}
+
+	if (n == 0)
+		goto err;
+
+	return gadget;
+
+err:
+	cfs_free_gadget_impl(gadget);
+	return NULL;
+}
+
+static void cfs_pool_exit(void)
+{
+	int i;
+
+	for (i = 0 ; i < pool_nr ; i++)
+		cfs_free_gadget_impl(pool[i].applied);
+	free(pool);
+	pool = NULL;
+	pool_nr = 0;
+}
+
+/*
+ * Prepare an unbound gadget for each mode of the pool, so switching
+ * to it only costs a UDC bind. Gadgets left by a previous instance
+ * are reused as they are.
+ */
+static void cfs_pool_init(void)
+{
+	char line[PATH_MAX], *mode, *funcs, *save;
+	struct usb_gadget *gadget;
+	struct cfs_gadget *g, *p;
+	char udc[VALUE_LEN];
+	FILE *fp;
+	int ret;
+
+	fp = fopen(USB_GADGET_POOL_CONF, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		mode = strtok_r(line, " \t\n", &save);
+		if (!mode || mode[0] == '#')
+			continue;
+		funcs = strtok_r(NULL, "\n", &save);
+		if (!funcs)
+			continue;
+
+		gadget = cfs_pool_parse(funcs);
+		if (!gadget) {
+			_E("Invalid gadget pool entry %s", mode);
+			continue;
+		}
+
+		p = realloc(pool, sizeof(*pool) * (pool_nr + 1));
+		if (!p) {
+			cfs_free_gadget_impl(gadget);
+			break;
+		}
+		pool = p;
+
+		g = &pool[pool_nr];
+		memset(g, 0, sizeof(*g));
+		snprintf(g->name, sizeof(g->name), "%s", mode);
+		snprintf(g->path, sizeof(g->path), "%s/%s.%s",
+				CONFIGFS_GADGET_PATH, GADGET_NAME, mode);
+		g->applied = gadget;
+		g->pooled = true;
+
+		if (cfs_get_udc(g, udc, sizeof(udc)) == 0 && udc[0]) {
+			bound = g;
+			active = g;
+		} else {
+			ret = cfs_sync_gadget(g, gadget, 1, true);
+			if (ret < 0) {
+				_E("Failed to prepare USB mode %s (%d)", mode, ret);
+				cfs_free_gadget_impl(gadget);
+				continue;
+			}
+		}
+
+		pool_nr++;
+		_I("USB mode %s prepared", mode);
+	}
+	fclose(fp);
+}
+
+/* The pool gadget with the same functions as 'gadget', if any */
+/* a pool function without instance stands for any instance of its type */
+static bool cfs_pool_function_match(struct usb_function *pool_func,
+		struct usb_function *func)
+{
+	char a[NAME_MAX], b[NAME_MAX];
+
+	if (!pool_func->instance)
+		return func->function_group != USB_FUNCTION_GROUP_WITH_SERVICE &&
+			!strcmp(pool_func->name, func->name);
+
+	cfs_function_name(pool_func, a, sizeof(a));
+	cfs_function_name(func, b, sizeof(b));
+	return !strcmp(a, b);
+}
+
+static struct cfs_gadget *cfs_pool_find(struct usb_gadget *gadget)
+{
+	struct usb_configuration *want, *config;
+	int i, j;
+
+	if (!gadget->configs[0] || gadget->configs[1])
+		return NULL;
+
+	want = gadget->configs[0];
+	for (i = 0 ; i < pool_nr ; i++) {
+		config = pool[i].applied->configs[0];
+		for (j = 0 ; j < MAX_FUNCS && config->funcs[j] && want->funcs[j] ; j++) {
+			if (!cfs_pool_function_match(config->funcs[j], want->funcs[j]))
+				break;
+		}
+		if (j == MAX_FUNCS || (!config->funcs[j] && !want->funcs[j]))
+			return &pool[i];
+	}
+
+	return NULL;
+}
+
+static bool cfs_is_function_supported_impl(struct usb_client *usb,
+		struct usb_function *func)
+{
+	unsigned int i;
+
+	if (!func || !func->name)
+		return false;
+
+	if (func->function_group == USB_FUNCTION_GROUP_WITH_SERVICE)
+		return true;
+
+	for (i = 0 ; i < ARRAY_SIZE(simple_types) ; i++) {
+		if (!strcmp(func->name, simple_types[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool cfs_is_function_supported(struct usb_client *usb,
+		struct usb_function *func)
+{
+	TRACE_OP("cfs_is_function_supported");
+
+	return cfs_is_function_supported_impl(usb, func);
+}
+
+static bool cfs_is_gadget_supported_impl(struct usb_client *usb,
+		struct usb_gadget *gadget)
+{
+	int i, j;
+
+	if (!gadget || !gadget->configs || !gadget->configs[0])
+		return false;
+
+	for (i = 0 ; gadget->configs[i] ; i++) {
+		if (i >= MAX_CONFIGS)
+			return false;
+		if (!gadget->configs[i]->funcs || !gadget->configs[i]->funcs[0])
+			return false;
+		for (j = 0 ; gadget->configs[i]->funcs[j] ; j++) {
+			if (j >= MAX_FUNCS)
+				return false;
+			if (!cfs_is_function_supported_impl(usb, gadget->configs[i]->funcs[j]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool cfs_is_gadget_supported(struct usb_client *usb,
+		struct usb_gadget *gadget)
+{
+	TRACE_OP("cfs_is_gadget_supported");
+
+	return cfs_is_gadget_supported_impl(usb, gadget);
+}
+
+static int cfs_get_current_gadget(struct usb_client *usb,
+		struct usb_gadget **gadget)
+{
+	struct usb_gadget *copy;
+
+	TRACE_OP("cfs_get_current_gadget");
+
+	if (!usb || !gadget)
+		return TRACE_RET(-EINVAL);
+	if (!cur_gadget)
+		return TRACE_RET(-ENOENT);
+
+	copy = cfs_copy_gadget(cur_gadget);
+	if (!copy)
+		return TRACE_RET(-ENOMEM);
+
+	*gadget = copy;
+	return 0;
+}
+
+/*
+ * A mode of the pool only needs its gadget to be bound. Other modes
+ * go to the default gadget, where only the parts of the configfs tree
+ * which differ from the requested gadget are touched. The UDC is
+ * released only when something has to change, and a bound gadget is
+ * bound again once the switch is done.
+ */
+static int cfs_reconfigure_gadget(struct usb_client *usb,
+		struct usb_gadget *gadget)
+{
+	char udc[VALUE_LEN] = "";
+	struct cfs_gadget *g;
+	struct usb_gadget *copy;
+	int nr_configs, ret;
+
+	TRACE_OP("cfs_reconfigure_gadget");
+
+	if (!usb || !gadget)
+		return TRACE_RET(-EINVAL);
+
+	if (!cfs_is_gadget_supported_impl(usb, gadget))
+		return TRACE_RET(-ENOTSUP);
+
+	clock_gettime(CLOCK_MONOTONIC, &switch_start);
+	switch_syscalls = io.syscalls;
+	switch_bytes = io.bytes;
+
+	for (nr_configs = 0 ; gadget->configs[nr_configs] ; nr_configs++)
+		;
+
+	g = cfs_pool_find(gadget);
+	if (!g)
+		g = &main_gadget;
+
+	ret = cfs_sync_gadget(g, gadget, nr_configs, false);
+	if (ret < 0)
+		return TRACE_RET(ret);
+
+	if (bound)
+		cfs_get_udc(bound, udc, sizeof(udc));
+
+	if (ret > 0) {
+		if (bound == g) {
+			ret = cfs_unbind(g);
+			if (ret < 0)
+				return TRACE_RET(ret);
+		}
+
+		ret = cfs_sync_gadget(g, gadget, nr_configs, true);
+		if (ret < 0) {
+			/* the next switch makes the links of every config again */
+			g->partial = true;
+			return TRACE_RET(ret);
+		}
+		g->partial = false;
+
+		_I("USB mode %s reconfigured with %d changes", g->name, ret);
+	}
+
+	if (bound && bound != g) {
+		ret = cfs_unbind(bound);
+		if (ret < 0)
+			return TRACE_RET(ret);
+	}
+
+	if (g == &main_gadget) {
+		copy = cfs_copy_gadget(gadget);
+		if (copy) {
+			cfs_free_gadget_impl(main_gadget.applied);
+			main_gadget.applied = copy;
+		} else
+			main_gadget.partial = true;
+	}
+
+	copy = cfs_copy_gadget(gadget);
+	if (copy) {
+		cfs_free_gadget_impl(cur_gadget);
+		cur_gadget = copy;
+	}
+
+	active = g;
+	switching = g;
+
+	if (udc[0] && bound != g) {
+		ret = cfs_bind(g, udc);
+		if (ret < 0)
+			return TRACE_RET(ret);
+	}
+	if (bound == g)
+		cfs_switch_done(g);
+
+	return 0;
+}
+
+static int cfs_enable(struct usb_client *usb)
+{
+	char udc[VALUE_LEN] = "";
+	int ret;
+
+	TRACE_OP("cfs_enable");
+
+	if (!usb)
+		return TRACE_RET(-EINVAL);
+
+	if (bound == active)
+		return 0;
+
+	if (bound) {
+		ret = cfs_unbind(bound);
+		if (ret < 0)
+			return TRACE_RET(ret);
+	}
+
+	ret = cfs_find_udc(udc, sizeof(udc));
+	if (ret < 0) {
+		_E("No UDC available");
+		return TRACE_RET(ret);
+	}
+
+	ret = cfs_bind(active, udc);
+	if (ret < 0)
+		return TRACE_RET(ret);
+
+	cfs_switch_done(active);
+	return 0;
+}
+
+static int cfs_disable(struct usb_client *usb)
+{
+	TRACE_OP("cfs_disable");
+
+	if (!usb)
+		return TRACE_RET(-EINVAL);
+
+	if (!bound)
+		return 0;
+
+	return TRACE_RET(cfs_unbind(bound));
+}
+
+static int cfs_get_mode_count(int *count)
+{
+	TRACE_OP("cfs_get_mode_count");
+
+	if (!count)
+		return TRACE_RET(-EINVAL);
+
+	*count = pool_nr + 1;
+	return 0;
+}
+
+static int cfs_get_mode_stats(int index, const char **name,
+		struct usb_mode_stats *stats)
+{
+	struct cfs_gadget *g;
+
+	TRACE_OP("cfs_get_mode_stats");
+
+	if (!name || !stats)
+		return TRACE_RET(-EINVAL);
+	if (index < 0 || index > pool_nr)
+		return TRACE_RET(-EINVAL);
+
+	g = (index == 0) ? &main_gadget : &pool[index - 1];
+	*name = g->name;
+	*stats = g->stats;
+	return 0;
+}
+
+static int cfs_client_open(struct hw_info *info,
+		const char *id, struct hw_common **common)
+{
+	struct usb_cfs_client_ext *ext;
+	struct usb_client *usb;
+	char udc[VALUE_LEN];
+
+	if (!info || !common)
+		return -EINVAL;
+
+	ext = calloc(1, sizeof(*ext));
+	if (!ext)
+		return -ENOMEM;
+	usb = &ext->client.dev;
+
+	if (refcount++ == 0) {
+		if (cfs_get_udc(&main_gadget, udc, sizeof(udc)) == 0 && udc[0])
+			bound = &main_gadget;
+		cfs_pool_init();
+	}
+	usb_state_init();
+
+	usb->common.info = info;
+	usb->get_current_gadget = cfs_get_current_gadget;
+	usb->reconfigure_gadget = cfs_reconfigure_gadget;
+	usb->is_gadget_supported = cfs_is_gadget_supported;
+	usb->is_function_supported = cfs_is_function_supported;
+	usb->enable = cfs_enable;
+	usb->disable = cfs_disable;
+	usb->free_gadget = cfs_free_gadget;
+	ext->client.get_state = usb_state_get;
+	ext->client.register_changed_event = usb_state_register_changed_event;
+	ext->client.unregister_changed_event = usb_state_unregister_changed_event;
+	ext->get_mode_count = cfs_get_mode_count;
+	ext->get_mode_stats = cfs_get_mode_stats;
+
+	*common = &usb->common;
+	return 0;
+}
+
+static int cfs_client_close(struct hw_common *common)
+{
+	struct usb_cfs_client_ext *ext;
+
+	if (!common)
+		return -EINVAL;
+
+	ext = container_of(common, struct usb_cfs_client_ext, client.dev.common);
+	free(ext);
+	usb_state_exit();
+
+	if (refcount == 0 || --refcount > 0)
+		return 0;
+
+	/* the configfs gadgets stay prepared for the next user */
+	active = &main_gadget;
+	bound = NULL;
+	switching = NULL;
+	cfs_pool_exit();
+	cfs_free_gadget_impl(main_gadget.applied);
+	main_gadget.applied = NULL;
+	cfs_free_gadget_impl(cur_gadget);
+	cur_gadget = NULL;
+
+	return 0;
+}
 
 HARDWARE_MODULE_STRUCTURE = {
 	.magic = HARDWARE_INFO_TAG,
@@ -24,6 +1486,6 @@ HARDWARE_MODULE_STRUCTURE = {
 	.device_version = USB_CLIENT_HARDWARE_DEVICE_VERSION,
 	.id = USB_CFS_CLIENT_HARDWARE_DEVICE_ID,
 	.name = "cfs-gadget",
-	.open = hw_cfs_gadget_open,
-	.close = hw_cfs_gadget_close,
+	.open = cfs_client_open,
+	.close = cfs_client_close,
 };
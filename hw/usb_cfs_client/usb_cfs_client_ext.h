@@ -0,0 +1,59 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __USB_CFS_CLIENT_EXT_H__
+#define __USB_CFS_CLIENT_EXT_H__
+
+#include <hw/usb_client.h>
+#include "../usb_client/usb_client_ext.h"
+
+/*
+ * Cost of the switches to a mode, from reconfigure_gadget to the gadget
+ * being bound to the UDC, so a switch done as disable/reconfigure/enable
+ * includes all three. Directory scans count as three syscalls, an
+ * estimate: bench/cfs_switch.c counts the real ones.
+ */
+struct usb_mode_stats {
+	unsigned int switches;
+	unsigned int last_us;
+	unsigned int max_us;
+	unsigned int avg_us;
+	unsigned int last_syscalls;  /* configfs and UDC accesses */
+	unsigned int last_bytes;     /* written to configfs and UDC */
+};
+
+/*
+ * Pico specific configfs usb client.
+ * The open function always returns this structure, so callers which
+ * know about the extension can cast the returned hw_common to it.
+ */
+struct usb_cfs_client_ext {
+	struct usb_client_ext client;
+
+	/*
+	 * Mode 0 is the default gadget, used for the gadgets which are
+	 * not part of the pool. The others are the prepared pool gadgets.
+	 * The name is owned by the module.
+	 */
+	int (*get_mode_count)(int *count);
+	int (*get_mode_stats)(int index, const char **name,
+			struct usb_mode_stats *stats);
+};
+
+#endif /* __USB_CFS_CLIENT_EXT_H__ */
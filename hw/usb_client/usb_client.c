@@ -16,7 +16,138 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+#include <errno.h>
+
 #include <hw/usb_client.h>
+#include <hw/shared.h>
+#include "usb_client_ext.h"
+
+#define TRACE_MODULE "usb_client"
+#include "../trace.h"
+
+/* The gadget itself is handled by the legacy client of hwcommon */
+struct legacy_client {
+	struct usb_client_ext ext;
+	struct usb_client *legacy;
+};
+
+#define to_legacy(usb) \
+	(container_of(usb, struct legacy_client, ext.dev)->legacy)
+
+static int legacy_get_current_gadget(struct usb_client *usb,
+		struct usb_gadget **gadget)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_get_current_gadget");
+
+	return TRACE_RET(legacy->get_current_gadget(legacy, gadget));
+}
+
+static int legacy_reconfigure_gadget(struct usb_client *usb,
+		struct usb_gadget *gadget)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_reconfigure_gadget");
+
+	return TRACE_RET(legacy->reconfigure_gadget(legacy, gadget));
+}
+
+static bool legacy_is_gadget_supported(struct usb_client *usb,
+		struct usb_gadget *gadget)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_is_gadget_supported");
+
+	return legacy->is_gadget_supported(legacy, gadget);
+}
+
+static bool legacy_is_function_supported(struct usb_client *usb,
+		struct usb_function *func)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_is_function_supported");
+
+	return legacy->is_function_supported(legacy, func);
+}
+
+static int legacy_enable(struct usb_client *usb)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_enable");
+
+	return TRACE_RET(legacy->enable(legacy));
+}
+
+static int legacy_disable(struct usb_client *usb)
+{
+	struct usb_client *legacy = to_legacy(usb);
+
+	TRACE_OP("legacy_disable");
+
+	return TRACE_RET(legacy->disable(legacy));
+}
+
+static int usb_client_open(struct hw_info *info,
+		const char *id, struct hw_common **common)
+{
+	struct legacy_client *client;
+	struct usb_client *usb;
+	struct hw_common *legacy;
+	int ret;
+
+	if (!info || !common)
+		return -EINVAL;
+
+	client = calloc(1, sizeof(*client));
+	if (!client)
+		return -ENOMEM;
+
+	ret = hw_legacy_gadget_open(info, id, &legacy);
+	if (ret < 0) {
+		free(client);
+		return ret;
+	}
+	client->legacy = container_of(legacy, struct usb_client, common);
+
+	usb = &client->ext.dev;
+	usb->common.info = info;
+	usb->get_current_gadget = legacy_get_current_gadget;
+	usb->reconfigure_gadget = legacy_reconfigure_gadget;
+	usb->is_gadget_supported = legacy_is_gadget_supported;
+	usb->is_function_supported = legacy_is_function_supported;
+	usb->enable = legacy_enable;
+	usb->disable = legacy_disable;
+	usb->free_gadget = client->legacy->free_gadget;
+	client->ext.get_state = usb_state_get;
+	client->ext.register_changed_event = usb_state_register_changed_event;
+	client->ext.unregister_changed_event = usb_state_unregister_changed_event;
+
+	usb_state_init();
+
+	*common = &usb->common;
+	return 0;
+}
+
+static int usb_client_close(struct hw_common *common)
+{
+	struct legacy_client *client;
+
+	if (!common)
+		return -EINVAL;
+
+	client = container_of(common, struct legacy_client, ext.dev.common);
+	usb_state_exit();
+	hw_legacy_gadget_close(&client->legacy->common);
+	free(client);
+
+	return 0;
+}
 
 HARDWARE_MODULE_STRUCTURE = {
 	.magic = HARDWARE_INFO_TAG,
@@ -24,6 +155,6 @@ HARDWARE_MODULE_STRUCTURE = {
 	.device_version = USB_CLIENT_HARDWARE_DEVICE_VERSION,
 	.id = USB_CLIENT_HARDWARE_DEVICE_ID,
 	.name = "legacy-gadget",
-	.open = hw_legacy_gadget_open,
-	.close = hw_legacy_gadget_close,
+	.open = usb_client_open,
+	.close = usb_client_close,
 };
@@ -0,0 +1,44 @@
+/*
+ * device-node
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __USB_CLIENT_EXT_H__
+#define __USB_CLIENT_EXT_H__
+
+#include <hw/usb_client.h>
+#include "../usb_state.h"
+
+/*
+ * Pico specific usb client.
+ * The usb_client and usb_cfs_client modules always return this
+ * structure, so callers which know about the extension can cast the
+ * returned hw_common to it.
+ */
+struct usb_client_ext {
+	struct usb_client dev;
+
+	/*
+	 * Cable and UDC state, kept up to date by extcon and udc uevents
+	 * and by the notifications of the UDC state attribute.
+	 */
+	int (*get_state)(struct usb_state *state);
+	int (*register_changed_event)(UsbStateChanged changed_cb, void *data);
+	void (*unregister_changed_event)(UsbStateChanged changed_cb);
+};
+
+#endif /* __USB_CLIENT_EXT_H__ */
@@ -0,0 +1,386 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <glib.h>
+#include <hw/shared.h>
+#include "udev.h"
+#include "usb_state.h"
+
+#define TRACE_MODULE "usb_state"
+#include "trace.h"
+
+#ifndef UDC_PATH
+#define UDC_PATH "/sys/class/udc"
+#endif
+#ifndef EXTCON_PATH
+#define EXTCON_PATH "/sys/class/extcon"
+#endif
+
+#define UDC_NOT_ATTACHED "not attached"
+
+struct usb_state_listener {
+	UsbStateChanged changed_cb;
+	void *data;
+};
+
+static struct {
+	int refcnt;
+	bool monitored;
+	struct usb_state state;
+
+	/* UDC whose state attribute is watched */
+	char udc[NAME_MAX];
+	int state_fd;
+	GIOChannel *ch;
+	guint watch;
+
+	/* every module of the process may listen */
+	GList *listeners;
+} usb = {
+	.state_fd = -1,
+};
+
+static int usb_find_udc(char *buf, size_t size)
+{
+	struct dirent *dir;
+	DIR *d;
+
+	d = opendir(UDC_PATH);
+	if (!d)
+		return -ENODEV;
+
+	while ((dir = readdir(d))) {
+		if (dir->d_name[0] == '.')
+			continue;
+		snprintf(buf, size, "%s", dir->d_name);
+		closedir(d);
+		return 0;
+	}
+	closedir(d);
+
+	return -ENODEV;
+}
+
+/* 1 if an extcon device reports a USB cable, 0 if none does, -errno if unknown */
+static int usb_read_extcon(void)
+{
+	char path[PATH_MAX], buf[256];
+	struct dirent *dir;
+	DIR *d;
+	FILE *fp;
+	bool found = false;
+	long len;
+	int ret = 0;
+
+	d = opendir(EXTCON_PATH);
+	if (!d)
+		return -ENODEV;
+
+	while ((dir = readdir(d)) && ret == 0) {
+		if (dir->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/state", EXTCON_PATH, dir->d_name);
+		TRACE_BEGIN(t);
+		fp = fopen(path, "r");
+		if (!fp) {
+			TRACE_SYSFS_READ(path, t, -errno);
+			continue;
+		}
+		len = 0;
+		/* one "<cable>=<0|1>" line per cable */
+		while (fgets(buf, sizeof(buf), fp)) {
+			len += strlen(buf);
+			if (strncmp(buf, "USB=", 4))
+				continue;
+			found = true;
+			if (buf[4] == '1')
+				ret = 1;
+		}
+		fclose(fp);
+		TRACE_SYSFS_READ(path, t, len);
+	}
+	closedir(d);
+
+	return found ? ret : -ENOENT;
+}
+
+static void usb_read_udc_state(char *buf, size_t size)
+{
+	ssize_t n;
+
+	snprintf(buf, size, "%s", UDC_NOT_ATTACHED);
+	if (usb.state_fd < 0)
+		return;
+
+	TRACE_BEGIN(t);
+	n = pread(usb.state_fd, buf, size - 1, 0);
+	TRACE_SYSFS_READ(usb.udc, t, n);
+	if (n <= 0) {
+		snprintf(buf, size, "%s", UDC_NOT_ATTACHED);
+		return;
+	}
+	buf[n] = '\0';
+	while (n > 0 && buf[n - 1] == '\n')
+		buf[--n] = '\0';
+}
+
+static void usb_state_notify(void)
+{
+	struct usb_state_listener *l;
+	GList *elem, *next;
+
+	/* a callback may unregister itself */
+	for (elem = usb.listeners ; elem ; elem = next) {
+		next = g_list_next(elem);
+		l = elem->data;
+		l->changed_cb(&usb.state, l->data);
+	}
+}
+
+static void usb_state_update(void)
+{
+	struct usb_state st;
+	int extcon;
+
+	memset(&st, 0, sizeof(st));
+	usb_read_udc_state(st.udc_state, sizeof(st.udc_state));
+	st.configured = !strcmp(st.udc_state, "configured");
+
+	/* without extcon the UDC tells whether a host is there */
+	extcon = usb_read_extcon();
+	if (extcon >= 0)
+		st.connected = extcon;
+	else
+		st.connected = strcmp(st.udc_state, UDC_NOT_ATTACHED);
+
+	if (!memcmp(&st, &usb.state, sizeof(st)))
+		return;
+
+	usb.state = st;
+	_I("USB %s, udc %s", st.connected ? "connected" : "disconnected",
+			st.udc_state);
+
+	usb_state_notify();
+}
+
+/* UDC state changes come through sysfs_notify, not as uevents */
+static gboolean usb_udc_state_changed(GIOChannel *channel,
+		GIOCondition cond, void *data)
+{
+	usb_state_update();
+	return G_SOURCE_CONTINUE;
+}
+
+static void usb_unwatch_udc(void)
+{
+	if (usb.watch) {
+		g_source_remove(usb.watch);
+		usb.watch = 0;
+	}
+	if (usb.ch) {
+		g_io_channel_unref(usb.ch);
+		usb.ch = NULL;
+	}
+	if (usb.state_fd >= 0) {
+		close(usb.state_fd);
+		usb.state_fd = -1;
+	}
+	usb.udc[0] = '\0';
+}
+
+static void usb_watch_udc(void)
+{
+	char path[PATH_MAX], udc[NAME_MAX], buf[USB_UDC_STATE_LEN];
+
+	if (usb_find_udc(udc, sizeof(udc)) < 0) {
+		usb_unwatch_udc();
+		return;
+	}
+	if (usb.state_fd >= 0 && !strcmp(udc, usb.udc))
+		return;
+
+	usb_unwatch_udc();
+
+	snprintf(path, sizeof(path), "%s/%s/state", UDC_PATH, udc);
+	usb.state_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (usb.state_fd < 0) {
+		_E("Failed to open %s (%d)", path, errno);
+		return;
+	}
+	snprintf(usb.udc, sizeof(usb.udc), "%s", udc);
+
+	/* sysfs only notifies a file which has been read once */
+	if (pread(usb.state_fd, buf, sizeof(buf), 0) < 0)
+		_E("Failed to read %s (%d)", path, errno);
+
+	usb.ch = g_io_channel_unix_new(usb.state_fd);
+	usb.watch = g_io_add_watch(usb.ch, G_IO_PRI | G_IO_ERR,
+			usb_udc_state_changed, NULL);
+	if (usb.watch == 0)
+		_E("Failed to watch %s", path);
+}
+
+static void udc_uevent_delivered(struct udev_device *dev)
+{
+	/* a UDC may come or go with its driver */
+	usb_watch_udc();
+	usb_state_update();
+}
+
+static void extcon_uevent_delivered(struct udev_device *dev)
+{
+	usb_state_update();
+}
+
+static struct uevent_handler udc_uh = {
+	.subsystem = "udc",
+	.uevent_func = udc_uevent_delivered,
+};
+
+static struct uevent_handler extcon_uh = {
+	.subsystem = "extcon",
+	.uevent_func = extcon_uevent_delivered,
+};
+
+static void usb_exit_monitor(void)
+{
+	if (!usb.monitored)
+		return;
+
+	unregister_kernel_event_control(&extcon_uh);
+	unregister_kernel_event_control(&udc_uh);
+	uevent_control_kernel_stop();
+	usb.monitored = false;
+}
+
+static int usb_init_monitor(void)
+{
+	int ret;
+
+	ret = register_kernel_event_control(&udc_uh);
+	if (ret < 0)
+		return ret;
+
+	ret = register_kernel_event_control(&extcon_uh);
+	if (ret < 0) {
+		unregister_kernel_event_control(&udc_uh);
+		return ret;
+	}
+
+	ret = uevent_control_kernel_start();
+	if (ret < 0) {
+		_E("Failed to start uevent control (%d)", ret);
+		unregister_kernel_event_control(&extcon_uh);
+		unregister_kernel_event_control(&udc_uh);
+		return ret;
+	}
+
+	usb.monitored = true;
+	return 0;
+}
+
+int usb_state_init(void)
+{
+	if (usb.refcnt++ > 0)
+		return 0;
+
+	usb_watch_udc();
+	usb_state_update();
+
+	if (usb_init_monitor() < 0)
+		_E("usb uevents are not available, state is not cached");
+
+	return 0;
+}
+
+void usb_state_exit(void)
+{
+	if (usb.refcnt == 0 || --usb.refcnt > 0)
+		return;
+
+	usb_exit_monitor();
+	usb_unwatch_udc();
+	memset(&usb.state, 0, sizeof(usb.state));
+	g_list_free_full(usb.listeners, free);
+	usb.listeners = NULL;
+}
+
+int usb_state_get(struct usb_state *state)
+{
+	TRACE_OP("usb_state_get");
+
+	if (!state)
+		return TRACE_RET(-EINVAL);
+
+	/* nothing keeps the cache up to date, read it now */
+	if (!usb.monitored) {
+		usb_watch_udc();
+		usb_state_update();
+	}
+
+	*state = usb.state;
+	return 0;
+}
+
+int usb_state_register_changed_event(UsbStateChanged changed_cb, void *data)
+{
+	struct usb_state_listener *l;
+
+	TRACE_OP("usb_state_register_changed_event");
+
+	if (!changed_cb)
+		return TRACE_RET(-EINVAL);
+
+	if (!usb.monitored)
+		return TRACE_RET(-ENOTSUP);
+
+	l = malloc(sizeof(struct usb_state_listener));
+	if (!l)
+		return TRACE_RET(-ENOMEM);
+	l->changed_cb = changed_cb;
+	l->data = data;
+
+	usb.listeners = g_list_append(usb.listeners, l);
+	return 0;
+}
+
+void usb_state_unregister_changed_event(UsbStateChanged changed_cb)
+{
+	struct usb_state_listener *l;
+	GList *elem;
+
+	TRACE_OP("usb_state_unregister_changed_event");
+
+	for (elem = usb.listeners ; elem ; elem = g_list_next(elem)) {
+		l = elem->data;
+		if (l->changed_cb != changed_cb)
+			continue;
+		usb.listeners = g_list_delete_link(usb.listeners, elem);
+		free(l);
+		return;
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * device-manager
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __USB_STATE_H__
+#define __USB_STATE_H__
+
+#include <stdbool.h>
+
+#define USB_UDC_STATE_LEN	32
+
+struct usb_state {
+	bool connected;   /* a cable to a host is attached */
+	bool configured;  /* the host has selected a configuration */
+	char udc_state[USB_UDC_STATE_LEN]; /* "not attached", "configured", ... */
+};
+
+/*
+ * Called from the main loop with the new state. Several callbacks may be
+ * registered, unregister removes the first one registered with changed_cb.
+ */
+typedef void (*UsbStateChanged)(const struct usb_state *state, void *data);
+
+/* Refcounted, the state is cached while at least one user is there */
+int usb_state_init(void);
+void usb_state_exit(void);
+
+int usb_state_get(struct usb_state *state);
+int usb_state_register_changed_event(UsbStateChanged changed_cb, void *data);
+void usb_state_unregister_changed_event(UsbStateChanged changed_cb);
+
+#endif /* __USB_STATE_H__ */
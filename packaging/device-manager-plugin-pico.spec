@@ -12,9 +12,17 @@ BuildRequires:  cmake
 BuildRequires:  pkgconfig(dlog)
 BuildRequires:  pkgconfig(hwcommon)
 BuildRequires:  pkgconfig(glib-2.0)
+BuildRequires:  pkgconfig(gio-2.0)
 BuildRequires:  pkgconfig(libudev)
 BuildRequires:  pkgconfig(libusbgx)
 
+%bcond_with monolithic
+%bcond_with lto
+%bcond_with trace
+%if %{with trace}
+BuildRequires:  systemtap-sdt-devel
+%endif
+
 %description
 Device manager plugin Pico Pi
 
@@ -24,7 +32,9 @@ Device manager plugin Pico Pi
 cp %{SOURCE1} .
 
 %build
-%cmake .
+%cmake . -DMONOLITHIC=%{?with_monolithic:ON}%{!?with_monolithic:OFF} \
+	-DLTO=%{?with_lto:ON}%{!?with_lto:OFF} \
+	-DTRACE=%{?with_trace:ON}%{!?with_trace:OFF}
 
 make %{?jobs:-j%jobs}
 
@@ -40,5 +50,6 @@ make %{?jobs:-j%jobs}
 
 %files
 %{_libdir}/hw/*.so
+%{_libdir}/libdevice-manager-pico-core.so
 %manifest %{name}.manifest
 %license LICENSE